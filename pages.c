@@ -2,235 +2,2885 @@
  * Author: RK
  */
 
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L  // clock_gettime, pread
+#endif
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
-#define RAM_SIZE        (1 << 20) // 1 MB
-#define PAGE_SIZE       4096
-#define NUM_PHYS_PAGES  (RAM_SIZE/PAGE_SIZE)
+#define DEFAULT_RAM_SIZE  (1 << 20) // 1 MB, VMConfig.ram_size overrides
+#define PAGE_SHIFT        12
+#define PAGE_SIZE         (1 << PAGE_SHIFT)
 
+// 4-level radix page table, 9 bits per level: 48-bit virtual addresses
+#define PT_LEVELS       4
+#define PT_BITS         9
+#define PT_ENTRIES      (1 << PT_BITS)
+#define VA_BITS         (PAGE_SHIFT + PT_LEVELS * PT_BITS)
+#define NUM_VIRT_PAGES  (1ULL << (VA_BITS - PAGE_SHIFT))
 
-#define L1_ENTRIES  16
-#define L2_ENTRIES  16
+// A superpage is a leaf one level above the bottom: 512 frames, 2 MB
+#define SUPERPAGE_LEVEL  (PT_LEVELS - 2)
+#define SUPERPAGE_ORDER  PT_BITS
+#define SUPERPAGE_PAGES  (1u << SUPERPAGE_ORDER)
 
 #define PTE_VALID 0x01
 #define PTE_WRITE 0x02
 #define PTE_READ  0x04
+#define PTE_HUGE  0x08  // superpage leaf above the bottom level
+#define PTE_SWAPPED 0x10  // not present, phys_page holds the swap slot
+#define PTE_ACCESSED 0x20 // set by translate() on every successful access
+#define PTE_DIRTY    0x40 // set by translate() on writes, cleared when written to swap
+#define PTE_LOCKED   0x80 // page-in in flight, phys_page holds the frame being filled
+#define PTE_SPECULATIVE 0x100  // mapped ahead of use, cleared on first translation
+#define PTE_FAULT_AROUND 0x200 // mapped by fault-around, cleared on first translation
+#define PTE_YOUNG    0x400 // set with PTE_ACCESSED, cleared only by the working-set scanner
+#define PTE_COW      0x800 // writable once the frame is no longer shared; PTE_WRITE is clear
 
+#define MGLRU_GENS        4     // generations policy_mglru keeps apart
+#define MGLRU_WALK_BATCH  4     // bottom-level tables aged per eviction
 
+#define SWAP_CLUSTER_PAGES 32   // slots handed out together for sequential write-out
+#define SWAP_BATCH_MAX     64   // largest VMConfig.swap_batch
+
+#define WSS_WINDOWS       3     // working-set windows tracked at once
+#define WSS_SCAN_BATCH    64    // frames examined per scanner step
+#define WSS_HISTORY       256   // samples kept for vm_wss_export()
+
+#define KSM_SCAN_BATCH    16    // frames hashed per same-page merging step
+#define KSM_PROBES        8     // table slots tried per lookup
+
+#define VM_MAX_REGIONS    16
+#define VM_MAX_SPACES     64    // address spaces alive at once, one ASID each
+#define RA_INITIAL_WINDOW 4   // pages read ahead once a stream is detected
+
+#define TLB_DEFAULT_SETS  16
+#define TLB_DEFAULT_WAYS  4
+
+#define EVENT_RING_SIZE   1024  // power of two
+
+#define BUDDY_MAX_ORDER   10    // largest block is 2^10 frames (4 MB)
+
+#define ZERO_POOL_DEFAULT 32
+
+#define ZSWAP_CLASS_SHIFT 6                    // size classes are 64 bytes apart
+#define ZSWAP_CLASSES     (PAGE_SIZE >> ZSWAP_CLASS_SHIFT)
+#define ZSWAP_MAX_LEN     (PAGE_SIZE * 3 / 4)  // pages that compress worse go to the file
+#define LZ_HASH_BITS      12
+
+enum{
+  VM_EV_PAGE_FAULT,
+  VM_EV_PAGE_ALLOC,
+  VM_EV_OUT_OF_MEMORY,
+  VM_EV_WRITE_DENIED,
+  VM_EV_READ_DENIED,
+  VM_EV_VADDR_OOB,
+  VM_EV_PADDR_OOB,
+  VM_EV_SWAP_OUT,
+  VM_EV_SWAP_IN,
+};
+
+typedef struct PageTable PageTable;
+
+typedef struct{
+  PageTable *next;  // lower-level table, interior levels only
+  int phys_page;    // leaf level only
+  uint16_t flags;   // valid, read/write permissions
+} PTEntry;
+
+// One node of the radix tree. Nodes are allocated on demand and freed once
+// their last entry is cleared, so only mapped regions cost table memory.
+struct PageTable{
+  PTEntry entries[PT_ENTRIES];
+  uint32_t used;  // non-empty entries
+};
+
+// An address space: its own page-table tree, and the ASID its TLB entries
+// are tagged with. RAM, the frame allocator, swap, regions and stats are
+// shared by every space.
+typedef struct VMSpace{
+  PageTable *root;  // allocated on first mapping
+  uint16_t asid;
+} VMSpace;
+
+typedef struct{
+  uint32_t page_faults;
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t translation_failures;
+  uint32_t tlb_hits;
+  uint32_t tlb_misses;
+  uint32_t tlb_evictions;
+  uint32_t events_dropped;
+  uint32_t free_blocks[BUDDY_MAX_ORDER + 1];  // free buddy blocks per order
+  uint32_t zero_pool_hits;
+  uint32_t zero_pool_misses;
+  uint32_t pt_tables;  // page-table nodes currently allocated
+  uint32_t superpages;
+  uint32_t swap_ins;
+  uint32_t swap_outs;
+  uint64_t swap_in_bytes;
+  uint64_t swap_out_bytes;
+  uint32_t clean_evictions;  // dropped, swap already held an up-to-date copy
+  uint32_t dirty_evictions;  // written back to swap
+  uint32_t swap_cluster_allocs;  // empty clusters opened for allocation
+  uint32_t swap_frag_allocs;     // slots taken outside a cluster, no empty one left
+  uint32_t swap_batch_writes;    // multi-page runs written with one writev()
+  uint32_t zswap_stores;      // pages compressed into the pool
+  uint32_t zswap_loads;       // faults served from the pool
+  uint32_t zswap_rejects;     // compressed to more than ZSWAP_MAX_LEN
+  uint32_t zswap_writebacks;  // pool entries pushed out to the swap file
+  uint32_t zswap_pool_pages;  // pool pages currently holding objects
+  uint64_t zswap_in_bytes;    // uncompressed bytes stored
+  uint64_t zswap_out_bytes;   // compressed bytes stored
+  uint64_t zswap_decompress_ns;
+  uint32_t async_swap_ins;  // page-ins handed to the I/O threads
+  uint32_t io_waits;        // faults that joined a page-in already in flight
+  uint32_t readahead_pages; // pages mapped or swapped in ahead of a stream
+  uint32_t readahead_hits;  // of those, later touched
+  uint32_t readahead_waste; // unmapped or evicted untouched
+  uint32_t fault_around_pages;  // neighbours mapped on someone else's fault
+  uint32_t fault_around_hits;   // of those, later touched
+  uint64_t wss_scanned;         // PTEs examined by the working-set scanner
+  uint32_t mglru_agings;        // youngest generations opened
+  uint32_t mglru_promotions;    // pages moved to the youngest generation
+  uint64_t mglru_scanned;       // PTEs examined while aging
+  uint32_t context_switches;    // vm_space_switch() calls that changed space
+  uint32_t tlb_reuse_hits;      // TLB hits on entries cached before the last switch
+  uint32_t clones;              // vm_clone() calls
+  uint64_t clone_ptes;          // entries copied by vm_clone()
+  uint32_t cow_copies;          // write faults that copied a shared frame
+  uint32_t cow_reuses;          // write faults that found the frame no longer shared
+  uint32_t zero_page_maps;      // read faults served by the shared zero page
+  uint32_t zero_page_upgrades;  // writes that replaced it with a real frame
+  uint64_t ksm_scanned;         // frames hashed by the same-page merging scanner
+  uint32_t ksm_merges;          // frames freed by merging into an identical one
+  uint32_t ksm_zero_merges;     // of those, merged into the zero page
+} VMStats;
+
+typedef struct ReplacementPolicy ReplacementPolicy;
+
+// A range of virtual pages with its own fault-time prefetch settings.
+typedef struct{
+  uint64_t start;          // first virtual page
+  uint64_t npages;
+  uint32_t readahead_max;  // largest readahead window in pages, 0 disables
+  uint32_t fault_around;   // aligned window mapped on each fault, power of two <= PT_ENTRIES, 0 disables
+} VMRegionConfig;
+
+// An access submitted with vm_submit(). result and, for reads, value are
+// filled in before done is called.
+typedef struct VMRequest{
+  uint64_t vaddr;
+  uint8_t value;
+  bool is_write;
+  int result;  // as returned by read_vmem()/write_vmem()
+  void (*done)(struct VMRequest *req);  // may be NULL
+  void *user;
+  struct VMRequest *next;  // internal
+  VMSpace *space;          // internal: space it was submitted in
+} VMRequest;
+
+// zero fields fall back to the defaults
+typedef struct{
+  uint64_t ram_size;  // bytes, multiple of PAGE_SIZE
+  uint32_t tlb_sets;  // power of two
+  uint32_t tlb_ways;
+  uint32_t zero_pool_size;  // capacity of the pre-zeroed frame pool
+  uint32_t swap_slots;      // pages of swap, 0 disables swapping
+  const char *swap_path;    // swap file, NULL for an anonymous tmpfile()
+  uint32_t swap_batch;      // pages evicted together when RAM is full, 0 for 1
+  uint32_t zswap_pages;     // compressed pool in front of the swap file, 0 disables
+  uint32_t io_threads;      // swap-in worker threads for vm_submit(), 0 disables
+  uint32_t readahead_max;   // readahead window cap outside any region, 0 disables
+  uint32_t fault_around;    // fault-around window outside any region, 0 disables
+  uint32_t wss_interval;    // translations between working-set scanner steps, 0 disables
+  uint32_t ksm_interval;    // translations between same-page merging steps, 0 disables
+  uint64_t wss_windows[WSS_WINDOWS];  // in translations, all zero for 1K/10K/100K
+  const ReplacementPolicy *policy;  // NULL for policy_clock
+} VMConfig;
+
+typedef struct{
+  uint64_t vpn;  // superpage number instead when flags has PTE_HUGE
+  PTEntry *pte;  // entry the translation came from, for the accessed bit
+  int phys_page;
+  uint16_t flags;  // copy of the PTE flags, 0 for an empty slot
+  uint16_t asid;   // space the translation belongs to
+  uint32_t switches;  // stats.context_switches when it was cached
+} TLBEntry;
+
+typedef struct{
+  TLBEntry *entries;  // sets * ways, set-major
+  uint32_t *victim;   // round-robin replacement cursor per set
+  uint32_t sets;
+  uint32_t ways;
+} TLB;
+
+// Two-level bitmap: a set bit in summary means the matching word has at
+// least one set bit, so a search touches one summary word per 4096 bits.
+typedef struct{
+  uint64_t *words;
+  uint64_t *summary;
+  uint32_t nbits;
+  uint32_t nwords;
+  uint32_t nsummary;
+  uint32_t hint;   // no summary word below this one has a set bit
+  uint32_t count;  // number of set bits
+} Bitmap;
+
+// A further PTE mapping a shared frame. Entries live in one growable
+// array and are chained by index, so a frame with n mappings holds n - 1.
+typedef struct{
+  PTEntry *pte;
+  VMSpace *space;
+  uint64_t vpn;
+  int32_t next;  // next entry of the same frame or of the free list, -1 ends
+} RMapEntry;
+
+typedef struct{
+  RMapEntry *entries;
+  uint32_t capacity;
+  int32_t free;  // first unused entry, -1 if none
+} RMapPool;
+
+// Reverse map from a physical frame to the PTEs mapping it, so eviction and
+// unmapping can find the entries to rewrite without walking page tables.
+typedef struct{
+  PTEntry *pte;  // NULL for free, pooled and superpage frames
+  uint64_t vpn;
+  VMSpace *space;  // space the page belongs to
+  uint32_t refs;   // PTEs mapping the frame, pte being the one tracked
+  int32_t rmap;    // RMapEntry chain of the other refs - 1 PTEs
+  bool aliased;    // mapped again by map_page(), pinned while shared
+  uint64_t ksm_hash;  // contents hash when the merging scanner last saw it
+  uint32_t pins;  // pinned frames are never evicted
+  int prev;       // intrusive list links owned by the replacement policy
+  int next;
+  uint64_t gen;   // policy_mglru generation (sequence number)
+  int64_t swap_slot;  // slot the page was read from, -1 if none
+  uint64_t last_used;  // vm_clock when the WSS scanner last saw the page young
+  bool in_io;          // being filled by an I/O thread, pinned until reaped
+  VMRequest *waiters;  // requests to run once the page-in completes
+} FrameDesc;
+
+// Slots are grouped into clusters of SWAP_CLUSTER_PAGES. New slots come
+// from one cluster at a time, in order, so pages evicted together land
+// next to each other in the file.
+typedef struct{
+  FILE *file;
+  int fd;             // fileno(file); all swap I/O goes through it, unbuffered
+  Bitmap free_slots;  // bit set = slot free
+  uint32_t *cluster_free;  // free slots per cluster
+  uint32_t nclusters;
+  uint32_t free_clusters;  // clusters with every slot free
+  int64_t cluster;         // cluster being filled, -1 if none
+  uint32_t next;           // next slot to try in it
+  uint32_t batch;          // victims per eviction
+  uint16_t *slot_refs;     // PTEs and frames holding each slot
+} SwapDevice;
+
+// Compressed copy of one swap slot
+typedef struct{
+  uint32_t handle;  // byte offset into the pool
+  uint16_t len;     // compressed length, 0 if the slot is not in the pool
+  int32_t prev;     // store order, oldest at lru_head, for write-back
+  int32_t next;
+} ZswapEntry;
+
+// Each pool page holds objects of a single size class; it goes back to the
+// free set once its last object is freed. Pages with a free object sit on
+// their class's partial list, so a store finds room without a search.
+typedef struct{
+  uint8_t *mem;
+  uint32_t npages;
+  int8_t *page_class;    // -1 for a free page
+  uint64_t *page_free;   // bit set = object free
+  int32_t *page_prev;    // partial list links; free pages chain through page_next
+  int32_t *page_next;
+  int32_t partial[ZSWAP_CLASSES];  // first page with a free object, per class
+  int32_t free_pages;    // first unused page, -1 if none
+  ZswapEntry *entries;   // one per swap slot
+  int32_t lru_head;
+  int32_t lru_tail;
+} Zswap;
+
+// Page replacement policy. Hooks see 4 KB frames only and may be NULL; a
+// NULL on_access keeps translate() free of any per-access call.
+struct ReplacementPolicy{
+  const char *name;
+  void (*init)(void);
+  void (*on_map)(int frame);
+  void (*on_access)(int frame);
+  void (*on_unmap)(int frame);
+  int  (*pick_victim)(void);  // an unpinned mapped frame, or -1
+};
+
+typedef struct{
+  uint64_t timestamp;         // vm_clock at the end of the scan pass
+  uint32_t wss[WSS_WINDOWS];  // pages used within each window
+} WSSSample;
+
+// Idle-page scanner. Every `interval` translations it examines the next
+// WSS_SCAN_BATCH frames, stamping each page found young with the current
+// clock and clearing the bit; a full pass over RAM yields one sample.
+typedef struct{
+  uint32_t interval;
+  uint32_t countdown;
+  uint64_t windows[WSS_WINDOWS];
+  uint32_t cursor;             // next frame to examine
+  uint32_t pass[WSS_WINDOWS];  // counts so far in the current pass
+  WSSSample history[WSS_HISTORY];
+  uint32_t nsamples;           // total taken; the ring holds the last WSS_HISTORY
+} WSSScanner;
+
+// Same-page merging. Every `interval` translations it hashes the next
+// KSM_SCAN_BATCH frames. A frame whose hash did not change since the last
+// pass is looked up in `table`, which is rebuilt every pass, and merged
+// into the frame found there once a full compare confirms the match.
+typedef struct{
+  uint32_t interval;
+  uint32_t countdown;
+  uint32_t cursor;     // next frame to hash
+  int32_t *table;      // frame per slot, -1 if empty
+  uint32_t mask;       // table size - 1
+  uint64_t zero_hash;  // hash of an all-zero page
+} KSMScanner;
+
+// Sequential-stream state kept per region
 typedef struct{
+  VMRegionConfig cfg;
+  uint64_t next_fault;  // page a sequential stream faults on next
+  uint32_t ra_window;   // current readahead window, 0 outside a stream
+} VMRegion;
+
+typedef struct{
+  int frame;
+  int result;
+} IOCompletion;
+
+// Swap-in worker pool. The workers only read slots into frames; everything
+// that touches VM state happens on the owning thread when completions are
+// reaped, so the rest of the simulator stays single-threaded.
+typedef struct{
+  pthread_t *threads;
+  uint32_t nthreads;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cv;
+  pthread_cond_t done_cv;
+  int *queue;             // frames to fill, ring of num_phys_pages entries
+  IOCompletion *done;     // finished reads, same size
+  uint32_t queue_head, queue_tail;
+  uint32_t done_head, done_tail;
+  bool stop;
+  uint32_t inflight;      // owner only
+  VMRequest *ready_head;  // owner only: requests waiting for vm_poll()
+  VMRequest *ready_tail;
+} IOPool;
+
+// Frames zeroed ahead of time, handed out by allocate_phys_page() without a
+// memset. They are allocated as far as the buddy allocator is concerned.
+typedef struct{
+  int *frames;
+  uint32_t count;
+  uint32_t capacity;
+} ZeroPool;
+
+typedef struct{
+  uint64_t timestamp;  // vm_clock at the time of the event
+  uint64_t vaddr;
+  int phys_page;
+  uint8_t type;
+} VMEvent;
+
+// Single-producer/single-consumer ring: the VM pushes, vm_events_drain pops.
+// A full ring drops the new event rather than blocking the access path.
+typedef struct{
+  VMEvent slots[EVENT_RING_SIZE];
+  uint32_t head;  // next slot to write, owned by the producer
+  uint32_t tail;  // next slot to read, owned by the consumer
+} EventRing;
+
+
+
+uint8_t *RAM;
+uint64_t ram_size;
+uint32_t num_phys_pages;
+uint32_t zero_frame;    // RAM frame past the last allocatable one, always zero
+VMSpace default_space;           // ASID 0, the space init_vm() starts in
+VMSpace *spaces[VM_MAX_SPACES] = { &default_space };  // live spaces by ASID
+VMSpace *cur_space = &default_space;
+FrameDesc *frames;      // one per physical page
+RMapPool rmap;
+SwapDevice swap;
+Zswap zswap;
+IOPool io;
+WSSScanner wss;
+KSMScanner ksm;
+VMRegion regions[VM_MAX_REGIONS];
+uint32_t nregions;
+VMRegion default_region;  // every page outside the regions above
+const ReplacementPolicy *policy;
+extern const ReplacementPolicy policy_clock, policy_fifo, policy_lru, policy_random, policy_mglru;
+Bitmap free_frames;  // bit set = physical page free
+ZeroPool zero_pool;
+Bitmap buddy_free[BUDDY_MAX_ORDER + 1];  // bit b of order k = frames [b<<k, (b+1)<<k) form a free block
+VMStats stats;
+TLB tlb;
+EventRing events;
+uint64_t vm_clock;  // one tick per translation
+
+int page_fault_handler(uint64_t virt_page);
+void free_pages(void);
+int allocate_phys_page(void);
+void zero_pool_drain(void);
+static int buddy_init(uint32_t nframes);
+static int swap_init(uint32_t nslots, const char *path, uint32_t zswap_pages, uint32_t batch);
+static void swap_free_slot(uint32_t slot);
+static int io_init(uint32_t nthreads);
+static int ksm_init(uint32_t interval);
+static void io_destroy(void);
+static void io_reap(bool wait);
+static void io_wait_frame(int frame);
+int vm_poll(bool wait);
+
+
+static inline void vm_event(uint8_t type, uint64_t vaddr, int phys_page){
+  uint32_t head = events.head;
+  if (head - __atomic_load_n(&events.tail, __ATOMIC_ACQUIRE) == EVENT_RING_SIZE){
+    stats.events_dropped++;
+    return;
+  }
+  VMEvent *ev   = &events.slots[head & (EVENT_RING_SIZE - 1)];
+  ev->timestamp = vm_clock;
+  ev->vaddr     = vaddr;
+  ev->phys_page = phys_page;
+  ev->type      = type;
+  __atomic_store_n(&events.head, head + 1, __ATOMIC_RELEASE);
+}
+
+bool vm_event_pop(VMEvent *out){
+  uint32_t tail = events.tail;
+  if (tail == __atomic_load_n(&events.head, __ATOMIC_ACQUIRE))
+    return false;
+  *out = events.slots[tail & (EVENT_RING_SIZE - 1)];
+  __atomic_store_n(&events.tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Pops every pending event, printing each to out unless out is NULL.
+size_t vm_events_drain(FILE *out){
+  static const char *names[] = {
+    [VM_EV_PAGE_FAULT]    = "page fault",
+    [VM_EV_PAGE_ALLOC]    = "alloc",
+    [VM_EV_OUT_OF_MEMORY] = "oopm",
+    [VM_EV_WRITE_DENIED]  = "write denied",
+    [VM_EV_READ_DENIED]   = "read denied",
+    [VM_EV_VADDR_OOB]     = "vaddr oob",
+    [VM_EV_PADDR_OOB]     = "paddr oob",
+    [VM_EV_SWAP_OUT]      = "swap out",
+    [VM_EV_SWAP_IN]       = "swap in",
+  };
+  VMEvent ev;
+  size_t n = 0;
+  while (vm_event_pop(&ev)){
+    if (out)
+      fprintf(out, "[%llu] %-12s vaddr 0x%llx phys %d\n", (unsigned long long)ev.timestamp,
+              names[ev.type], (unsigned long long)ev.vaddr, ev.phys_page);
+    n++;
+  }
+  return n;
+}
+
+void bitmap_destroy(Bitmap *bm){
+  free(bm->words);
+  free(bm->summary);
+  memset(bm, 0, sizeof(*bm));
+}
+
+int bitmap_init(Bitmap *bm, uint32_t nbits, bool all_set){
+  bitmap_destroy(bm);
+  bm->nbits    = nbits;
+  bm->nwords   = (nbits + 63) / 64;
+  bm->nsummary = (bm->nwords + 63) / 64;
+  bm->words    = calloc(bm->nwords ? bm->nwords : 1, sizeof(uint64_t));
+  bm->summary  = calloc(bm->nsummary ? bm->nsummary : 1, sizeof(uint64_t));
+  if (!bm->words || !bm->summary){
+    bitmap_destroy(bm);
+    return -1;
+  }
+  if (!all_set)
+    return 0;
+  for (uint32_t w = 0; w < bm->nwords; w++){
+    uint32_t left = nbits - w * 64;
+    bm->words[w] = left >= 64 ? ~0ULL : (1ULL << left) - 1;
+    bm->summary[w / 64] |= 1ULL << (w % 64);
+    bm->count += __builtin_popcountll(bm->words[w]);
+  }
+  return 0;
+}
+
+static inline bool bitmap_test(const Bitmap *bm, uint32_t i){
+  return (bm->words[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void bitmap_set(Bitmap *bm, uint32_t i){
+  uint32_t w = i / 64;
+  uint64_t bit = 1ULL << (i % 64);
+  if (bm->words[w] & bit)  return;
+  bm->words[w] |= bit;
+  bm->summary[w / 64] |= 1ULL << (w % 64);
+  if (w / 64 < bm->hint)
+    bm->hint = w / 64;
+  bm->count++;
+}
+
+static inline void bitmap_clear(Bitmap *bm, uint32_t i){
+  uint32_t w = i / 64;
+  uint64_t bit = 1ULL << (i % 64);
+  if (!(bm->words[w] & bit))  return;
+  bm->words[w] &= ~bit;
+  if (!bm->words[w])
+    bm->summary[w / 64] &= ~(1ULL << (w % 64));
+  bm->count--;
+}
+
+// Index of the lowest set bit, or -1 if none.
+static inline int64_t bitmap_find_first(Bitmap *bm){
+  for (uint32_t s = bm->hint; s < bm->nsummary; s++){
+    if (!bm->summary[s])  continue;
+    bm->hint = s;
+    uint32_t w = s * 64 + __builtin_ctzll(bm->summary[s]);
+    return (int64_t)w * 64 + __builtin_ctzll(bm->words[w]);
+  }
+  bm->hint = bm->nsummary;
+  return -1;
+}
+
+void tlb_flush(void){
+  if (tlb.entries)
+    memset(tlb.entries, 0, sizeof(TLBEntry) * tlb.sets * tlb.ways);
+}
+
+// Superpage entries are tagged with vpn >> SUPERPAGE_ORDER and share the
+// sets with 4 KB entries; PTE_HUGE keeps the two tag spaces apart.
+// Entries carry the ASID of their space, so switching spaces needs no
+// flush; a lookup only matches entries of the space asked for.
+static inline TLBEntry* tlb_probe(uint16_t asid, uint64_t tag, uint8_t huge){
+  TLBEntry *set = &tlb.entries[(tag & (tlb.sets - 1)) * tlb.ways];
+  for (uint32_t w = 0; w < tlb.ways; w++){
+    if ((set[w].flags & (PTE_VALID | PTE_HUGE)) == (PTE_VALID | huge) &&
+        set[w].vpn == tag && set[w].asid == asid)
+      return &set[w];
+  }
+  return NULL;
+}
+
+static inline TLBEntry* tlb_lookup(uint16_t asid, uint64_t vpn){
+  TLBEntry *te = tlb_probe(asid, vpn, 0);
+  if (!te && stats.superpages)
+    te = tlb_probe(asid, vpn >> SUPERPAGE_ORDER, PTE_HUGE);
+  return te;
+}
+
+// Always probes the superpage tag too: the caller may just have dropped
+// the last superpage, and stats.superpages no longer covers its entry.
+static void tlb_invalidate_asid(uint16_t asid, uint64_t vpn){
+  if (!tlb.entries)  return;
+  TLBEntry *te;
+  while ((te = tlb_probe(asid, vpn, 0)))
+    te->flags = 0;
+  while ((te = tlb_probe(asid, vpn >> SUPERPAGE_ORDER, PTE_HUGE)))
+    te->flags = 0;
+}
+
+// Drops any cached translation covering vpn in the current space, 4 KB or
+// superpage.
+void tlb_invalidate(uint64_t vpn){
+  tlb_invalidate_asid(cur_space->asid, vpn);
+}
+
+static void tlb_flush_asid(uint16_t asid){
+  for (uint32_t i = 0; tlb.entries && i < tlb.sets * tlb.ways; i++){
+    if (tlb.entries[i].asid == asid)
+      tlb.entries[i].flags = 0;
+  }
+}
+
+static void tlb_insert(uint64_t vpn, PTEntry *pte, int phys_page, uint16_t flags){
+  uint32_t s = vpn & (tlb.sets - 1);
+  TLBEntry *set = &tlb.entries[s * tlb.ways];
+  TLBEntry *slot = NULL;
+  for (uint32_t w = 0; w < tlb.ways; w++){
+    if (!set[w].flags){
+      slot = &set[w];
+      break;
+    }
+  }
+  if (!slot){
+    slot = &set[tlb.victim[s]];
+    tlb.victim[s] = (tlb.victim[s] + 1) % tlb.ways;
+    stats.tlb_evictions++;
+  }
+  slot->vpn       = vpn;
+  slot->pte       = pte;
+  slot->phys_page = phys_page;
+  slot->flags     = flags;
+  slot->asid      = cur_space->asid;
+  slot->switches  = stats.context_switches;
+}
+
+static void tlb_destroy(void){
+  free(tlb.entries);
+  free(tlb.victim);
+  memset(&tlb, 0, sizeof(tlb));
+}
+
+int init_vm_config(const VMConfig *cfg){
+  uint32_t sets = cfg && cfg->tlb_sets ? cfg->tlb_sets : TLB_DEFAULT_SETS;
+  uint32_t ways = cfg && cfg->tlb_ways ? cfg->tlb_ways : TLB_DEFAULT_WAYS;
+  uint64_t ram = cfg && cfg->ram_size ? cfg->ram_size : DEFAULT_RAM_SIZE;
+  if (sets & (sets - 1)){
+    fprintf(stderr, "ERROR: tlb sets %u not a power of two\n", sets);
+    return -1;
+  }
+  if (ram % PAGE_SIZE || ram / PAGE_SIZE > INT32_MAX){
+    fprintf(stderr, "ERROR: bad ram size %llu\n", (unsigned long long)ram);
+    return -1;
+  }
+  uint32_t around = cfg ? cfg->fault_around : 0;
+  if (around & (around - 1) || around > PT_ENTRIES){
+    fprintf(stderr, "ERROR: bad fault-around window %u\n", around);
+    return -1;
+  }
+  uint32_t batch = cfg && cfg->swap_batch ? cfg->swap_batch : 1;
+  if (batch > SWAP_BATCH_MAX){
+    fprintf(stderr, "ERROR: swap batch %u above %u\n", batch, SWAP_BATCH_MAX);
+    return -1;
+  }
+
+  free_pages();
+  io_destroy();
+  memset(&stats, 0, sizeof(stats));
+  memset(regions, 0, sizeof(regions));
+  nregions = 0;
+  memset(&default_region, 0, sizeof(default_region));
+  default_region.cfg.npages        = NUM_VIRT_PAGES;
+  default_region.cfg.readahead_max = cfg ? cfg->readahead_max : 0;
+  default_region.cfg.fault_around  = around;
+
+  static const uint64_t wss_default[WSS_WINDOWS] = { 1000, 10000, 100000 };
+  memset(&wss, 0, sizeof(wss));
+  wss.interval  = cfg ? cfg->wss_interval : 0;
+  wss.countdown = wss.interval;
+  bool windows_set = false;
+  for (int k = 0; k < WSS_WINDOWS; k++)
+    windows_set |= cfg && cfg->wss_windows[k];
+  for (int k = 0; k < WSS_WINDOWS; k++)
+    wss.windows[k] = windows_set ? cfg->wss_windows[k] : wss_default[k];
+  memset(&events, 0, sizeof(events));
+  vm_clock = 0;
+
+  tlb_destroy();
+  tlb.entries = calloc((size_t)sets * ways, sizeof(TLBEntry));
+  tlb.victim  = calloc(sets, sizeof(uint32_t));
+  if (!tlb.entries || !tlb.victim){
+    fprintf(stderr, "ERROR: mem alloc failed\n");
+    tlb_destroy();
+    return -1;
+  }
+  tlb.sets = sets;
+  tlb.ways = ways;
+
+  free(zero_pool.frames);
+  memset(&zero_pool, 0, sizeof(zero_pool));
+  zero_pool.capacity = cfg && cfg->zero_pool_size ? cfg->zero_pool_size : ZERO_POOL_DEFAULT;
+  zero_pool.frames = malloc(zero_pool.capacity * sizeof(int));
+
+  policy = cfg && cfg->policy ? cfg->policy : &policy_clock;
+  policy->init();
+
+  free(RAM);
+  free(frames);
+  free(rmap.entries);
+  memset(&rmap, 0, sizeof(rmap));
+  rmap.free = -1;
+  ram_size       = ram;
+  num_phys_pages = ram / PAGE_SIZE;
+  zero_frame     = num_phys_pages;
+  RAM    = calloc(ram_size + PAGE_SIZE, 1);  // the zero frame sits past the end
+  frames = calloc(num_phys_pages + 1, sizeof(FrameDesc));
+
+  if (!zero_pool.frames || !RAM || !frames || buddy_init(num_phys_pages) != 0 ||
+      swap_init(cfg ? cfg->swap_slots : 0, cfg ? cfg->swap_path : NULL,
+                cfg ? cfg->zswap_pages : 0, batch) != 0 ||
+      io_init(cfg && swap.file ? cfg->io_threads : 0) != 0 ||
+      ksm_init(cfg ? cfg->ksm_interval : 0) != 0){
+    fprintf(stderr, "ERROR: mem alloc failed\n");
+    tlb_destroy();
+    return -1;
+  }
+  return 0;
+}
+
+void init_vm(void){
+  init_vm_config(NULL);
+}
+
+
+
+
+PageTable* allocate_table(void){
+  PageTable *t = malloc(sizeof(PageTable));
+  if (!t){
+    fprintf(stderr, "ERROR: mem alloc failed\n");
+    return NULL;
+  }
+  for (int i = 0; i < PT_ENTRIES; i++){
+    t->entries[i].next      = NULL;
+    t->entries[i].phys_page = -1;
+    t->entries[i].flags     = 0;
+  }
+  t->used = 0;
+  stats.pt_tables++;
+  return t;
+}
+
+static inline uint32_t pt_index(uint64_t vpn, int level){
+  return (vpn >> ((PT_LEVELS - 1 - level) * PT_BITS)) & (PT_ENTRIES - 1);
+}
+
+// Table at depth level on the way to vpn, creating missing ones. NULL on
+// allocation failure or if a superpage already covers vpn.
+static PageTable* pt_table_at(uint64_t vpn, int level){
+  if (!cur_space->root && !(cur_space->root = allocate_table()))
+    return NULL;
+  PageTable *t = cur_space->root;
+  for (int l = 0; l < level; l++){
+    PTEntry *e = &t->entries[pt_index(vpn, l)];
+    if (e->flags & PTE_HUGE)
+      return NULL;
+    if (!e->next){
+      if (!(e->next = allocate_table()))
+        return NULL;
+      t->used++;
+    }
+    t = e->next;
+  }
+  return t;
+}
+
+// Entry that maps vpn in space: a bottom-level PTE, or the superpage entry
+// the walk stopped at. NULL if a table on the way is missing.
+static PTEntry* pt_lookup_in(VMSpace *space, uint64_t vpn){
+  PageTable *t = space->root;
+  if (!t)  return NULL;
+  for (int level = 0; level < PT_LEVELS - 1; level++){
+    PTEntry *e = &t->entries[pt_index(vpn, level)];
+    if (e->flags & PTE_HUGE)
+      return e;
+    if (!(t = e->next))
+      return NULL;
+  }
+  return &t->entries[pt_index(vpn, PT_LEVELS - 1)];
+}
+
+static PTEntry* pt_lookup(uint64_t vpn){
+  return pt_lookup_in(cur_space, vpn);
+}
+
+/*
+ * Binary buddy allocator. Each order keeps its free blocks in a Bitmap so
+ * finding, splitting and coalescing are bit operations; free_frames mirrors
+ * the same state per frame.
+ */
+static inline void buddy_push(uint32_t order, uint32_t block){
+  bitmap_set(&buddy_free[order], block);
+  stats.free_blocks[order]++;
+}
+
+static inline void buddy_pop(uint32_t order, uint32_t block){
+  bitmap_clear(&buddy_free[order], block);
+  stats.free_blocks[order]--;
+}
+
+static int buddy_init(uint32_t nframes){
+  if (bitmap_init(&free_frames, nframes, true) != 0)
+    return -1;
+  for (uint32_t k = 0; k <= BUDDY_MAX_ORDER; k++){
+    if (bitmap_init(&buddy_free[k], nframes >> k, false) != 0)
+      return -1;
+  }
+  // carve the frame range into the largest aligned blocks that fit
+  uint32_t frame = 0;
+  while (frame < nframes){
+    uint32_t k = BUDDY_MAX_ORDER;
+    while ((frame & ((1u << k) - 1)) || frame + (1u << k) > nframes)
+      k--;
+    buddy_push(k, frame >> k);
+    frame += 1u << k;
+  }
+  return 0;
+}
+
+// Returns the first frame of 2^order contiguous frames, or -1. The lowest
+// addressed free block of a sufficient order is split, which keeps
+// allocations packed at the bottom of RAM. Frames are not zeroed.
+int alloc_phys_pages(uint32_t order){
+  if (order > BUDDY_MAX_ORDER)
+    return -1;
+  int64_t best = -1;
+  uint32_t best_order = 0;
+  for (uint32_t k = order; k <= BUDDY_MAX_ORDER; k++){
+    int64_t b = bitmap_find_first(&buddy_free[k]);
+    if (b >= 0 && (best < 0 || (b << k) < best)){
+      best = b << k;
+      best_order = k;
+    }
+  }
+  if (best < 0){
+    // pooled frames are free in all but name; give them back and retry
+    if (zero_pool.count == 0)
+      return -1;
+    zero_pool_drain();
+    return alloc_phys_pages(order);
+  }
+
+  uint32_t frame = (uint32_t)best;
+  buddy_pop(best_order, frame >> best_order);
+  for (uint32_t k = best_order; k > order; k--)
+    buddy_push(k - 1, (frame >> (k - 1)) + 1);  // upper half stays free
+  for (uint32_t i = 0; i < (1u << order); i++)
+    bitmap_clear(&free_frames, frame + i);
+  return (int)frame;
+}
+
+void free_phys_pages(int frame, uint32_t order){
+  if (order > BUDDY_MAX_ORDER || frame < 0 || (frame & ((1 << order) - 1)) ||
+      (uint32_t)frame + (1u << order) > num_phys_pages)
+    return;
+  for (uint32_t i = 0; i < (1u << order); i++){
+    if (bitmap_test(&free_frames, frame + i))
+      return;  // double free
+  }
+  for (uint32_t i = 0; i < (1u << order); i++)
+    bitmap_set(&free_frames, frame + i);
+
+  uint32_t block = frame >> order;
+  while (order < BUDDY_MAX_ORDER){
+    uint32_t buddy = block ^ 1;
+    if (buddy >= buddy_free[order].nbits || !bitmap_test(&buddy_free[order], buddy))
+      break;
+    buddy_pop(order, buddy);
+    block >>= 1;
+    order++;
+  }
+  buddy_push(order, block);
+}
+
+// Takes one specific free frame out of the buddy lists, splitting the block
+// that contains it. Does nothing if the frame is already in use.
+static void reserve_phys_page(uint32_t frame){
+  uint32_t k = 0;
+  while (k <= BUDDY_MAX_ORDER &&
+         (frame >> k >= buddy_free[k].nbits || !bitmap_test(&buddy_free[k], frame >> k)))
+    k++;
+  if (k > BUDDY_MAX_ORDER)
+    return;
+  buddy_pop(k, frame >> k);
+  for (; k > 0; k--)
+    buddy_push(k - 1, (frame >> (k - 1)) ^ 1);  // the half without frame
+  bitmap_clear(&free_frames, frame);
+}
+
+// Zeroes up to max frames into the pool, stopping when it is full or RAM
+// runs out. Meant for idle time; returns the number of frames added.
+uint32_t zero_pool_refill(uint32_t max){
+  uint32_t n = 0;
+  // only the buddy lists; alloc_phys_pages() would drain the pool into them
+  while (n < max && zero_pool.count < zero_pool.capacity && free_frames.count){
+    int f = alloc_phys_pages(0);
+    if (f < 0)  break;
+    memset(&RAM[f*PAGE_SIZE], 0, PAGE_SIZE);
+    zero_pool.frames[zero_pool.count++] = f;
+    n++;
+  }
+  return n;
+}
+
+void zero_pool_drain(void){
+  while (zero_pool.count)
+    free_phys_pages(zero_pool.frames[--zero_pool.count], 0);
+}
+
+// Pulls a specific frame out of the pool; true if it was there.
+static bool zero_pool_has(int frame){
+  for (uint32_t i = 0; i < zero_pool.count; i++){
+    if (zero_pool.frames[i] == frame)
+      return true;
+  }
+  return false;
+}
+
+static bool zero_pool_take(int frame){
+  for (uint32_t i = 0; i < zero_pool.count; i++){
+    if (zero_pool.frames[i] == frame){
+      zero_pool.frames[i] = zero_pool.frames[--zero_pool.count];
+      return true;
+    }
+  }
+  return false;
+}
+
+int allocate_phys_page(void){
+  if (zero_pool.count){
+    stats.zero_pool_hits++;
+    return zero_pool.frames[--zero_pool.count];
+  }
+  stats.zero_pool_misses++;
+  int i = alloc_phys_pages(0);
+  if (i < 0)
+    return -1;
+  memset(&RAM[i*PAGE_SIZE], 0, PAGE_SIZE);
+  return i;
+}
+
+
+void free_phys_page(int phys_page){
+  if (phys_page >= 0 && (uint32_t)phys_page < num_phys_pages){
+    free_phys_pages(phys_page, 0);
+  }
+}
+
+
+
+// Records pte as the mapping of frame and tells the policy about it.
+static void frame_track(int frame, VMSpace *space, PTEntry *pte, uint64_t vpn){
+  if (frames[frame].pte && policy->on_unmap)
+    policy->on_unmap(frame);
+  frames[frame].pte   = pte;
+  frames[frame].vpn   = vpn;
+  frames[frame].space = space;
+  frames[frame].refs  = 1;
+  frames[frame].rmap  = -1;
+  frames[frame].aliased = false;
+  frames[frame].swap_slot = -1;
+  frames[frame].last_used = vm_clock;  // mapped by a fault, so in use now
+  if (policy->on_map)
+    policy->on_map(frame);
+}
+
+static VMRegion* region_find(uint64_t vpn);
+
+static void frame_untrack(int frame){
+  if (!frames[frame].pte)
+    return;
+  if (frames[frame].pte->flags & PTE_SPECULATIVE){
+    VMRegion *r = region_find(frames[frame].vpn);
+    r->ra_window /= 2;
+    stats.readahead_waste++;
+  }
+  frames[frame].pte->flags &= ~(PTE_SPECULATIVE | PTE_FAULT_AROUND);
+  if (policy->on_unmap)
+    policy->on_unmap(frame);
+  if (frames[frame].swap_slot >= 0)
+    swap_free_slot(frames[frame].swap_slot);
+  frames[frame].pte = NULL;
+  frames[frame].swap_slot = -1;
+}
+
+// Makes sure the next frame_share() has an entry to use.
+static int rmap_reserve(void){
+  if (rmap.free >= 0)
+    return 0;
+  uint32_t cap = rmap.capacity ? rmap.capacity * 2 : 64;
+  RMapEntry *e = realloc(rmap.entries, cap * sizeof(RMapEntry));
+  if (!e){
+    fprintf(stderr, "ERROR: mem alloc failed\n");
+    return -1;
+  }
+  for (uint32_t i = rmap.capacity; i < cap; i++)
+    e[i].next = i + 1 < cap ? (int32_t)i + 1 : -1;
+  rmap.entries  = e;
+  rmap.free     = rmap.capacity;
+  rmap.capacity = cap;
+  return 0;
+}
+
+// Adds pte as one more mapping of a tracked frame. rmap_reserve() must
+// have succeeded first.
+static void frame_share(int frame, VMSpace *space, PTEntry *pte, uint64_t vpn){
+  int32_t i = rmap.free;
+  RMapEntry *r = &rmap.entries[i];
+  rmap.free = r->next;
+  r->pte   = pte;
+  r->space = space;
+  r->vpn   = vpn;
+  r->next  = frames[frame].rmap;
+  frames[frame].rmap = i;
+  frames[frame].refs++;
+}
+
+// Drops pte's reference to frame, returning true if it was the last. If
+// the tracked PTE leaves a shared frame, the first one chained takes over.
+static bool frame_put(int frame, PTEntry *pte){
+  FrameDesc *f = &frames[frame];
+  if ((uint32_t)frame == zero_frame)
+    return false;
+  if (f->refs <= 1){
+    frame_untrack(frame);
+    f->refs = 0;
+    return true;
+  }
+  int32_t *link = &f->rmap;
+  if (f->pte == pte){
+    RMapEntry *r = &rmap.entries[f->rmap];
+    f->pte   = r->pte;
+    f->space = r->space;
+    f->vpn   = r->vpn;
+    pte->flags &= ~(PTE_SPECULATIVE | PTE_FAULT_AROUND);
+  } else {
+    while (rmap.entries[*link].pte != pte)
+      link = &rmap.entries[*link].next;
+  }
+  int32_t dead = *link;
+  *link = rmap.entries[dead].next;
+  rmap.entries[dead].next = rmap.free;
+  rmap.free = dead;
+  if (pte->flags & PTE_DIRTY)
+    f->pte->flags |= PTE_DIRTY;  // eviction only looks at the tracked PTE
+  if (--f->refs == 1 && f->aliased){
+    f->aliased = false;
+    f->pins--;
+  }
+  return false;
+}
+
+// Maps virt_page to a frame that is free, freshly allocated by the caller
+// or already mapped elsewhere. Whatever virt_page mapped before is released.
+static int map_frame(uint64_t virt_page, uint32_t phys_page, uint8_t flags){
+  PageTable *t = pt_table_at(virt_page, PT_LEVELS - 1);
+  if (!t || rmap_reserve() != 0)
+    return -1;
+
+  PTEntry *entry = &t->entries[pt_index(virt_page, PT_LEVELS - 1)];
+  if (entry->flags & PTE_LOCKED)
+    io_wait_frame(entry->phys_page);
+  if (entry->flags & PTE_VALID){
+    if (frame_put(entry->phys_page, entry))
+      free_phys_page(entry->phys_page);
+  } else if (entry->flags & PTE_SWAPPED)
+    swap_free_slot(entry->phys_page);
+  else
+    t->used++;
+  entry->phys_page 	= phys_page;
+  entry->flags			=	flags | PTE_VALID;
+	if (!zero_pool_take(phys_page))
+		reserve_phys_page(phys_page);
+  FrameDesc *f = &frames[phys_page];
+  if (f->pte){
+    // swap cannot keep writable aliases in step, so they stay resident
+    frame_share(phys_page, cur_space, entry, virt_page);
+    if (!f->aliased){
+      f->aliased = true;
+      f->pins++;
+    }
+  } else {
+    frame_track(phys_page, cur_space, entry, virt_page);
+  }
+  tlb_invalidate(virt_page);
+  return 0;
+}
+
+int map_page(uint64_t virt_page, uint32_t phys_page, uint8_t flags){
+  if (virt_page >= NUM_VIRT_PAGES){
+    fprintf(stderr, "ERROR: virt page 0x%llx oob\n", (unsigned long long)virt_page);
+    return -1;
+  }
+
+
+  if (phys_page >= num_phys_pages){
+    fprintf(stderr, "ERROR: phys page %u oob\n", phys_page);
+    return -1;
+  }
+  // superpage frames and frames mid page-in are in use but have no PTE to share
+  if (!bitmap_test(&free_frames, phys_page) && !frames[phys_page].pte &&
+      !zero_pool_has(phys_page)){
+    fprintf(stderr, "ERROR: phys page %u in use\n", phys_page);
+    return -1;
+  }
+  return map_frame(virt_page, phys_page, flags);
+}
+
+static void wss_step(void){
+  uint32_t end = wss.cursor + WSS_SCAN_BATCH;
+  if (end > num_phys_pages)
+    end = num_phys_pages;
+  for (uint32_t f = wss.cursor; f < end; f++){
+    PTEntry *pte = frames[f].pte;
+    if (!pte)
+      continue;
+    if (pte->flags & PTE_YOUNG){
+      pte->flags &= ~PTE_YOUNG;
+      frames[f].last_used = vm_clock;
+    }
+    for (int k = 0; k < WSS_WINDOWS; k++)
+      wss.pass[k] += vm_clock - frames[f].last_used <= wss.windows[k];
+  }
+  stats.wss_scanned += end - wss.cursor;
+  wss.cursor = end;
+  if (wss.cursor == num_phys_pages){
+    WSSSample *smp = &wss.history[wss.nsamples++ % WSS_HISTORY];
+    smp->timestamp = vm_clock;
+    memcpy(smp->wss, wss.pass, sizeof(smp->wss));
+    memset(wss.pass, 0, sizeof(wss.pass));
+    wss.cursor = 0;
+  }
+}
+
+// Working-set size in pages over window k, from the last complete scan
+// pass; 0 before the first pass completes.
+uint32_t vm_wss(int k){
+  if (!wss.nsamples || k < 0 || k >= WSS_WINDOWS)
+    return 0;
+  return wss.history[(wss.nsamples - 1) % WSS_HISTORY].wss[k];
+}
+
+// Writes the retained samples as CSV, oldest first. Returns the count.
+size_t vm_wss_export(FILE *out){
+  uint32_t first = wss.nsamples > WSS_HISTORY ? wss.nsamples - WSS_HISTORY : 0;
+  fprintf(out, "timestamp");
+  for (int k = 0; k < WSS_WINDOWS; k++)
+    fprintf(out, ",wss_%llu", (unsigned long long)wss.windows[k]);
+  fprintf(out, "\n");
+  for (uint32_t i = first; i < wss.nsamples; i++){
+    WSSSample *smp = &wss.history[i % WSS_HISTORY];
+    fprintf(out, "%llu", (unsigned long long)smp->timestamp);
+    for (int k = 0; k < WSS_WINDOWS; k++)
+      fprintf(out, ",%u", smp->wss[k]);
+    fprintf(out, "\n");
+  }
+  return wss.nsamples - first;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r){
+  return (x << r) | (x >> (64 - r));
+}
+
+// Four independent multiply-xor lanes over the page's 64-bit words, so the
+// compiler can keep them in vector registers.
+static uint64_t page_hash(const uint8_t *page){
+  uint64_t h[4] = { 0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL,
+                    0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL };
+  for (size_t i = 0; i < PAGE_SIZE; i += 4 * sizeof(uint64_t)){
+    for (int l = 0; l < 4; l++){
+      uint64_t w;
+      memcpy(&w, page + i + l * sizeof(uint64_t), sizeof(w));
+      h[l] = (h[l] ^ w) * 0x9E3779B97F4A7C15ULL;
+    }
+  }
+  return h[0] ^ rotl64(h[1], 17) ^ rotl64(h[2], 31) ^ rotl64(h[3], 47);
+}
+
+static int ksm_init(uint32_t interval){
+  free(ksm.table);
+  memset(&ksm, 0, sizeof(ksm));
+  if (!interval)
+    return 0;
+  uint32_t size = 1;
+  while (size < 2 * num_phys_pages)
+    size <<= 1;
+  if (!(ksm.table = malloc(size * sizeof(int32_t))))
+    return -1;
+  memset(ksm.table, -1, size * sizeof(int32_t));
+  ksm.mask      = size - 1;
+  ksm.interval  = interval;
+  ksm.countdown = interval;
+  ksm.zero_hash = page_hash(&RAM[(uint64_t)zero_frame * PAGE_SIZE]);
+  return 0;
+}
+
+// Points frame's only PTE at keep (a frame or the zero page), making both
+// sides copy-on-write, and frees frame.
+static void ksm_merge(int frame, int keep){
+  PTEntry *pte = frames[frame].pte;
+  VMSpace *space = frames[frame].space;
+  uint64_t vpn = frames[frame].vpn;
+  if ((uint32_t)keep != zero_frame){
+    if (rmap_reserve() != 0)
+      return;
+    PTEntry *kp = frames[keep].pte;
+    if (kp->flags & PTE_WRITE){
+      kp->flags = (kp->flags & ~PTE_WRITE) | PTE_COW;
+      tlb_invalidate_asid(frames[keep].space->asid, frames[keep].vpn);
+    }
+    frame_share(keep, space, pte, vpn);
+  } else {
+    stats.ksm_zero_merges++;
+  }
+  frame_untrack(frame);
+  free_phys_page(frame);
+  pte->phys_page = keep;
+  if (pte->flags & PTE_WRITE)
+    pte->flags = (pte->flags & ~PTE_WRITE) | PTE_COW;
+  pte->flags &= ~PTE_DIRTY;
+  tlb_invalidate_asid(space->asid, vpn);
+  stats.ksm_merges++;
+}
+
+// A frame can be merged away only while its one PTE is the tracked one and
+// nobody holds it; pinned frames may be mid-access.
+static void ksm_step(void){
+  uint32_t end = ksm.cursor + KSM_SCAN_BATCH;
+  if (end > num_phys_pages)
+    end = num_phys_pages;
+  for (uint32_t f = ksm.cursor; f < end; f++){
+    FrameDesc *d = &frames[f];
+    if (!d->pte || d->pins)
+      continue;
+    const uint8_t *page = &RAM[(uint64_t)f * PAGE_SIZE];
+    uint64_t h = page_hash(page);
+    if (h != d->ksm_hash){
+      d->ksm_hash = h;  // changed since the last pass; wait for it to settle
+      continue;
+    }
+    if (h == ksm.zero_hash && d->refs == 1 &&
+        !memcmp(page, &RAM[(uint64_t)zero_frame * PAGE_SIZE], PAGE_SIZE)){
+      ksm_merge(f, zero_frame);
+      continue;
+    }
+    for (uint32_t i = 0; i < KSM_PROBES; i++){
+      int32_t *slot = &ksm.table[(h + i) & ksm.mask];
+      int32_t k = *slot;
+      if (k < 0){
+        *slot = f;
+        break;
+      }
+      if ((uint32_t)k == f || frames[k].ksm_hash != h || !frames[k].pte || frames[k].pins)
+        continue;
+      if (d->refs == 1 && !memcmp(page, &RAM[(uint64_t)k * PAGE_SIZE], PAGE_SIZE)){
+        ksm_merge(f, k);
+        break;
+      }
+    }
+  }
+  stats.ksm_scanned += end - ksm.cursor;
+  ksm.cursor = end;
+  if (ksm.cursor == num_phys_pages){
+    memset(ksm.table, -1, (ksm.mask + 1) * sizeof(int32_t));
+    ksm.cursor = 0;
+  }
+}
+
+// translate() without the background scanner steps, for the retry after a
+// fault: a scan there could merge the page the fault just made writable.
+static int translate_once(uint64_t vaddr, uint64_t *out_paddr, bool is_write){
+  vm_clock++;
+  if (vaddr >> VA_BITS){
+		vm_event(VM_EV_VADDR_OOB, vaddr, -1);
+		stats.translation_failures++;
+		return -1;
+	}
+  uint64_t vpn = vaddr >> PAGE_SHIFT;
+  uint16_t off=(vaddr & (PAGE_SIZE - 1));
   int phys_page;
-  uint8_t flags;  // valid, read/write permissions
-} L2Entry;
+  uint16_t flags;
+  PTEntry *entry;
+
+  TLBEntry *te = tlb_lookup(cur_space->asid, vpn);
+  if (te){
+    stats.tlb_hits++;
+    if (te->switches != stats.context_switches)
+      stats.tlb_reuse_hits++;  // a flush on switch would have lost it
+    entry     = te->pte;
+    phys_page = te->phys_page;
+    flags     = te->flags;
+  } else {
+    stats.tlb_misses++;
+    entry = pt_lookup(vpn);
+    if (!entry || !(entry->flags & PTE_VALID)){
+      stats.translation_failures++;
+      return -1;
+    }
+    if (entry->flags & (PTE_SPECULATIVE | PTE_FAULT_AROUND)){
+      if (entry->flags & PTE_SPECULATIVE)  stats.readahead_hits++;
+      else                                 stats.fault_around_hits++;
+      entry->flags &= ~(PTE_SPECULATIVE | PTE_FAULT_AROUND);
+    }
+    phys_page = entry->phys_page;
+    flags     = entry->flags;
+    tlb_insert(flags & PTE_HUGE ? vpn >> SUPERPAGE_ORDER : vpn, entry, phys_page, flags);
+  }
+  if (flags & PTE_HUGE)
+    phys_page += vpn & (SUPERPAGE_PAGES - 1);
+
+	if (is_write && !(flags & PTE_WRITE)){
+		if (flags & PTE_COW){
+			stats.translation_failures++;
+			return -1;  // a fault, handled by copying the frame
+		}
+		vm_event(VM_EV_WRITE_DENIED, vaddr, phys_page);
+		stats.translation_failures++;
+		return -2;
+	}
+	if (!is_write && !(flags & PTE_READ)){
+		vm_event(VM_EV_READ_DENIED, vaddr, phys_page);
+		stats.translation_failures++;
+		return -2;
+	}
+	uint64_t paddr = (uint64_t)phys_page * PAGE_SIZE + off;
+	if (paddr >= ram_size && (uint32_t)phys_page != zero_frame){
+		vm_event(VM_EV_PADDR_OOB, vaddr, phys_page);
+		stats.translation_failures++;
+		return -1;
+	}
+  entry->flags |= is_write ? PTE_ACCESSED | PTE_YOUNG | PTE_DIRTY : PTE_ACCESSED | PTE_YOUNG;
+  if (policy->on_access && !(flags & PTE_HUGE) && (uint32_t)phys_page != zero_frame)
+    policy->on_access(phys_page);
+  *out_paddr = paddr;
+  return 0;
+}
+
+int translate(uint64_t vaddr, uint64_t *out_paddr, bool is_write){
+  if (wss.interval && --wss.countdown == 0){
+    wss.countdown = wss.interval;
+    wss_step();
+  }
+  if (ksm.interval && --ksm.countdown == 0){
+    ksm.countdown = ksm.interval;
+    ksm_step();
+  }
+  return translate_once(vaddr, out_paddr, is_write);
+}
+
+// Clears the entry at level that maps vpn, frees its frames and releases
+// the tables this leaves empty. level is SUPERPAGE_LEVEL or the bottom.
+static int pt_clear(uint64_t vpn, int level){
+	if (vpn >= NUM_VIRT_PAGES || !cur_space->root){
+		return -1;
+	}
+
+	// remember the path so emptied tables can be released bottom-up
+	PageTable *path[PT_LEVELS];
+	PageTable *t = cur_space->root;
+	for (int l = 0; l < level; l++){
+		path[l] = t;
+		PTEntry *e = &t->entries[pt_index(vpn, l)];
+		if (e->flags & PTE_HUGE)	return -1;
+		t = e->next;
+		if (!t)	return -1;
+	}
+	path[level] = t;
+
+	PTEntry *entry = &t->entries[pt_index(vpn, level)];
+	bool huge = level < PT_LEVELS - 1;
+	if (huge && (entry->next || !(entry->flags & PTE_HUGE)))
+		return -1;
+	if (entry->flags & PTE_LOCKED)
+		io_wait_frame(entry->phys_page);
+	if (entry->flags & PTE_VALID){
+		if (huge || frame_put(entry->phys_page, entry))
+			free_phys_pages(entry->phys_page, huge ? SUPERPAGE_ORDER : 0);
+		t->used--;
+		if (huge)	stats.superpages--;
+	} else if (entry->flags & PTE_SWAPPED){
+		swap_free_slot(entry->phys_page);
+		t->used--;
+	}
+	entry->phys_page = -1;
+	entry->flags = 0;
+	tlb_invalidate(vpn);
+
+	for (int l = level; l > 0 && path[l]->used == 0; l--){
+		free(path[l]);
+		stats.pt_tables--;
+		path[l - 1]->entries[pt_index(vpn, l - 1)].next = NULL;
+		path[l - 1]->used--;
+	}
+	return 0;
+}
+
+int unmap_page(uint64_t virt_page){
+	return pt_clear(virt_page, PT_LEVELS - 1);
+}
+
+// Maps SUPERPAGE_PAGES contiguous frames starting at phys_page with a single
+// entry one level above the bottom; both page numbers must be aligned to
+// SUPERPAGE_PAGES and the range must not already hold 4 KB mappings.
+int map_superpage(uint64_t virt_page, uint32_t phys_page, uint8_t flags){
+  if (virt_page >= NUM_VIRT_PAGES || virt_page & (SUPERPAGE_PAGES - 1)){
+    fprintf(stderr, "ERROR: virt page 0x%llx not a superpage\n", (unsigned long long)virt_page);
+    return -1;
+  }
+  if (phys_page & (SUPERPAGE_PAGES - 1) || phys_page + SUPERPAGE_PAGES > num_phys_pages){
+    fprintf(stderr, "ERROR: phys page %u not a superpage\n", phys_page);
+    return -1;
+  }
+  PageTable *t = pt_table_at(virt_page, SUPERPAGE_LEVEL);
+  if (!t)
+    return -1;
+  PTEntry *entry = &t->entries[pt_index(virt_page, SUPERPAGE_LEVEL)];
+  if (entry->next){
+    fprintf(stderr, "ERROR: virt page 0x%llx already has 4K mappings\n", (unsigned long long)virt_page);
+    return -1;
+  }
+  // every frame must be free, or part of the superpage being replaced
+  bool old = entry->flags & PTE_VALID;
+  for (uint32_t i = 0; i < SUPERPAGE_PAGES; i++){
+    uint32_t f = phys_page + i;
+    if (!bitmap_test(&free_frames, f) && !zero_pool_has(f) &&
+        !(old && f - (uint32_t)entry->phys_page < SUPERPAGE_PAGES)){
+      fprintf(stderr, "ERROR: phys page %u in use\n", f);
+      return -1;
+    }
+  }
+
+  if (old){
+    free_phys_pages(entry->phys_page, SUPERPAGE_ORDER);
+    stats.superpages--;
+    t->used--;
+  }
+  entry->phys_page = phys_page;
+  entry->flags     = flags | PTE_VALID | PTE_HUGE;
+  t->used++;
+  stats.superpages++;
+  for (uint32_t i = 0; i < SUPERPAGE_PAGES; i++){
+    if (!zero_pool_take(phys_page + i))
+      reserve_phys_page(phys_page + i);
+  }
+  tlb_invalidate(virt_page);
+  return 0;
+}
+
+int unmap_superpage(uint64_t virt_page){
+  if (virt_page & (SUPERPAGE_PAGES - 1))
+    return -1;
+  return pt_clear(virt_page, SUPERPAGE_LEVEL);
+}
+
+/*
+ * Swap. A page-out writes the frame to a free slot and turns the PTE into
+ * a non-present PTE_SWAPPED entry whose phys_page is the slot number; the
+ * permission bits stay so a page-in can restore the mapping as it was.
+ * With zswap enabled the slot's contents are kept compressed in memory
+ * instead, and only reach the file when the pool runs out of room.
+ */
+static void zswap_destroy(void){
+  free(zswap.mem);
+  free(zswap.page_class);
+  free(zswap.page_free);
+  free(zswap.page_prev);
+  free(zswap.page_next);
+  free(zswap.entries);
+  memset(&zswap, 0, sizeof(zswap));
+}
+
+static int zswap_init(uint32_t npages, uint32_t nslots){
+  zswap.lru_head = zswap.lru_tail = -1;
+  if (!npages)
+    return 0;
+  zswap.mem        = malloc((size_t)npages * PAGE_SIZE);
+  zswap.page_class = malloc(npages);
+  zswap.page_free  = calloc(npages, sizeof(uint64_t));
+  zswap.page_prev  = malloc(npages * sizeof(int32_t));
+  zswap.page_next  = malloc(npages * sizeof(int32_t));
+  zswap.entries    = calloc(nslots, sizeof(ZswapEntry));
+  if (!zswap.mem || !zswap.page_class || !zswap.page_free || !zswap.page_prev ||
+      !zswap.page_next || !zswap.entries){
+    zswap_destroy();
+    return -1;
+  }
+  memset(zswap.page_class, -1, npages);
+  for (int c = 0; c < ZSWAP_CLASSES; c++)
+    zswap.partial[c] = -1;
+  for (uint32_t p = 0; p < npages; p++)
+    zswap.page_next[p] = p + 1 < npages ? (int32_t)p + 1 : -1;
+  zswap.free_pages = 0;
+  zswap.npages = npages;
+  return 0;
+}
+
+static void swap_destroy(void){
+  if (swap.file)
+    fclose(swap.file);
+  bitmap_destroy(&swap.free_slots);
+  free(swap.cluster_free);
+  free(swap.slot_refs);
+  memset(&swap, 0, sizeof(swap));
+  zswap_destroy();
+}
+
+static uint32_t swap_cluster_size(uint32_t c){
+  uint32_t left = swap.free_slots.nbits - c * SWAP_CLUSTER_PAGES;
+  return left < SWAP_CLUSTER_PAGES ? left : SWAP_CLUSTER_PAGES;
+}
+
+static int swap_init(uint32_t nslots, const char *path, uint32_t zswap_pages, uint32_t batch){
+  swap_destroy();
+  if (!nslots)
+    return 0;
+  swap.nclusters    = (nslots + SWAP_CLUSTER_PAGES - 1) / SWAP_CLUSTER_PAGES;
+  swap.cluster_free = malloc(swap.nclusters * sizeof(uint32_t));
+  swap.slot_refs    = calloc(nslots, sizeof(uint16_t));
+  swap.file = path ? fopen(path, "w+b") : tmpfile();
+  if (!swap.file || !swap.cluster_free || !swap.slot_refs || bitmap_init(&swap.free_slots, nslots, true) != 0 ||
+      zswap_init(zswap_pages, nslots) != 0){
+    swap_destroy();
+    return -1;
+  }
+  swap.fd = fileno(swap.file);
+  for (uint32_t c = 0; c < swap.nclusters; c++)
+    swap.cluster_free[c] = swap_cluster_size(c);
+  swap.free_clusters = swap.nclusters;
+  swap.cluster = -1;
+  swap.batch   = batch;
+  return 0;
+}
+
+static void swap_take_slot(uint32_t slot){
+  uint32_t c = slot / SWAP_CLUSTER_PAGES;
+  if (swap.cluster_free[c]-- == swap_cluster_size(c))
+    swap.free_clusters--;
+  bitmap_clear(&swap.free_slots, slot);
+  swap.slot_refs[slot] = 1;
+}
+
+// Next free slot of the cluster being filled, opening the lowest empty
+// cluster when it runs out. Only when no cluster is empty does a slot come
+// from wherever the bitmap has one.
+static int64_t swap_alloc_slot(void){
+  if (swap.cluster >= 0){
+    uint32_t end = swap.cluster * SWAP_CLUSTER_PAGES + swap_cluster_size(swap.cluster);
+    for (; swap.next < end; swap.next++){
+      if (bitmap_test(&swap.free_slots, swap.next)){
+        swap_take_slot(swap.next);
+        return swap.next++;
+      }
+    }
+    swap.cluster = -1;
+  }
+  if (swap.free_clusters){
+    for (uint32_t c = 0; c < swap.nclusters; c++){
+      if (swap.cluster_free[c] == swap_cluster_size(c)){
+        swap.cluster = c;
+        swap.next    = c * SWAP_CLUSTER_PAGES + 1;
+        stats.swap_cluster_allocs++;
+        swap_take_slot(c * SWAP_CLUSTER_PAGES);
+        return c * SWAP_CLUSTER_PAGES;
+      }
+    }
+  }
+  int64_t slot = bitmap_find_first(&swap.free_slots);
+  if (slot >= 0){
+    swap_take_slot(slot);
+    stats.swap_frag_allocs++;
+  }
+  return slot;
+}
+
+// Share of free slots stranded in partly used clusters.
+static double swap_fragmentation(void){
+  uint32_t free = swap.free_slots.count;
+  uint32_t whole = 0;
+  for (uint32_t c = 0; c < swap.nclusters; c++){
+    if (swap.cluster_free[c] == swap_cluster_size(c))
+      whole += swap.cluster_free[c];
+  }
+  return free ? (double)(free - whole) / free : 0.0;
+}
+
+static int swap_write(uint32_t slot, const uint8_t *buf){
+  if (pwrite(swap.fd, buf, PAGE_SIZE, (off_t)slot * PAGE_SIZE) != PAGE_SIZE)
+    return -1;
+  stats.swap_outs++;
+  stats.swap_out_bytes += PAGE_SIZE;
+  return 0;
+}
+
+// n pages to consecutive slots starting at first, in one writev(). Only
+// this function moves the file offset; everything else uses pread/pwrite.
+static int swap_write_run(uint32_t first, struct iovec *iov, uint32_t n){
+  if (n == 1)
+    return swap_write(first, iov[0].iov_base);
+  size_t len = (size_t)n * PAGE_SIZE;
+  if (lseek(swap.fd, (off_t)first * PAGE_SIZE, SEEK_SET) < 0 ||
+      writev(swap.fd, iov, n) != (ssize_t)len)
+    return -1;
+  stats.swap_outs += n;
+  stats.swap_out_bytes += len;
+  stats.swap_batch_writes++;
+  return 0;
+}
+
+static int swap_read(uint32_t slot, uint8_t *buf){
+  if (pread(swap.fd, buf, PAGE_SIZE, (off_t)slot * PAGE_SIZE) != PAGE_SIZE)
+    return -1;
+  stats.swap_ins++;
+  stats.swap_in_bytes += PAGE_SIZE;
+  return 0;
+}
+
+/*
+ * LZ77 compressor in the LZ4 block layout. Each sequence is a token byte
+ * (literal count in the high nibble, match length - 4 in the low one, 15
+ * meaning more length bytes follow), the literals, then a 2-byte offset
+ * and the match. The last sequence has literals only.
+ */
+static uint32_t lz_read32(const uint8_t *p){
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint8_t *lz_put_len(uint8_t *op, uint32_t len){
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+// Compressed length of a page, or 0 if it does not fit in cap bytes.
+static uint32_t lz_compress(const uint8_t *src, uint8_t *dst, uint32_t cap){
+  uint16_t table[1 << LZ_HASH_BITS] = {0};  // position + 1 of the last sequence per hash
+  uint8_t *op = dst, *end = dst + cap;
+  uint32_t ip = 0, anchor = 0;
+
+  while (ip + 4 <= PAGE_SIZE){
+    uint32_t seq = lz_read32(src + ip);
+    uint32_t h   = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    uint32_t ref = table[h];
+    table[h] = ip + 1;
+    if (!ref || lz_read32(src + ref - 1) != seq){
+      ip++;
+      continue;
+    }
+    ref--;
+    uint32_t len = 4;
+    while (ip + len < PAGE_SIZE && src[ref + len] == src[ip + len])
+      len++;
+
+    uint32_t lit = ip - anchor;
+    if (op + 1 + lit / 255 + 1 + lit + 2 + len / 255 + 1 > end)
+      return 0;
+    uint8_t *token = op++;
+    *token = (lit < 15 ? lit : 15) << 4 | (len - 4 < 15 ? len - 4 : 15);
+    if (lit >= 15)	op = lz_put_len(op, lit - 15);
+    memcpy(op, src + anchor, lit);
+    op += lit;
+    *op++ = (ip - ref) & 0xff;
+    *op++ = (ip - ref) >> 8;
+    if (len - 4 >= 15)	op = lz_put_len(op, len - 4 - 15);
+    ip += len;
+    anchor = ip;
+  }
+
+  uint32_t lit = PAGE_SIZE - anchor;
+  if (lit){
+    if (op + 1 + lit / 255 + 1 + lit > end)
+      return 0;
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15)	op = lz_put_len(op, lit - 15);
+    memcpy(op, src + anchor, lit);
+    op += lit;
+  }
+  return op - dst;
+}
+
+static int lz_get_len(const uint8_t *src, uint32_t n, uint32_t *ip, uint32_t *len){
+  uint8_t b;
+  do {
+    if (*ip >= n)	return -1;
+    b = src[(*ip)++];
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+static int lz_decompress(const uint8_t *src, uint32_t n, uint8_t *dst){
+  uint32_t ip = 0, op = 0;
+  while (ip < n){
+    uint8_t token = src[ip++];
+    uint32_t lit = token >> 4;
+    if (lit == 15 && lz_get_len(src, n, &ip, &lit) != 0)
+      return -1;
+    if (lit > n - ip || lit > PAGE_SIZE - op)
+      return -1;
+    memcpy(dst + op, src + ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == n)
+      break;
+
+    if (n - ip < 2)
+      return -1;
+    uint32_t off = src[ip] | src[ip + 1] << 8;
+    ip += 2;
+    uint32_t len = (token & 15) + 4;
+    if ((token & 15) == 15 && lz_get_len(src, n, &ip, &len) != 0)
+      return -1;
+    if (!off || off > op || len > PAGE_SIZE - op)
+      return -1;
+    for (uint32_t i = 0; i < len; i++, op++)  // may overlap its own output
+      dst[op] = dst[op - off];
+  }
+  return op == PAGE_SIZE ? 0 : -1;
+}
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t zswap_class_size(int c){
+  return (uint32_t)(c + 1) << ZSWAP_CLASS_SHIFT;
+}
+
+static uint64_t zswap_full_mask(int c){
+  uint32_t n = PAGE_SIZE / zswap_class_size(c);
+  return n >= 64 ? ~0ULL : (1ULL << n) - 1;
+}
+
+static void zswap_partial_add(int c, int32_t p){
+  zswap.page_prev[p] = -1;
+  zswap.page_next[p] = zswap.partial[c];
+  if (zswap.partial[c] >= 0)
+    zswap.page_prev[zswap.partial[c]] = p;
+  zswap.partial[c] = p;
+}
 
+static void zswap_partial_del(int c, int32_t p){
+  if (zswap.page_prev[p] >= 0)  zswap.page_next[zswap.page_prev[p]] = zswap.page_next[p];
+  else                          zswap.partial[c] = zswap.page_next[p];
+  if (zswap.page_next[p] >= 0)  zswap.page_prev[zswap.page_next[p]] = zswap.page_prev[p];
+}
 
-typedef struct{
-  L2Entry entries[L2_ENTRIES];
-} L2Table;
+// Pool offset of a free object of len bytes, or -1 if the pool is full.
+static int64_t zswap_alloc(uint32_t len){
+  int c = (len - 1) >> ZSWAP_CLASS_SHIFT;
+  int32_t p = zswap.partial[c];
+  bool fresh = p < 0;
+  if (fresh){
+    if ((p = zswap.free_pages) < 0)
+      return -1;
+    zswap.free_pages    = zswap.page_next[p];
+    zswap.page_class[p] = c;
+    zswap.page_free[p]  = zswap_full_mask(c);
+    stats.zswap_pool_pages++;
+  }
+  int obj = __builtin_ctzll(zswap.page_free[p]);
+  zswap.page_free[p] &= ~(1ULL << obj);
+  if (fresh && zswap.page_free[p])
+    zswap_partial_add(c, p);
+  else if (!fresh && !zswap.page_free[p])
+    zswap_partial_del(c, p);
+  return (int64_t)p * PAGE_SIZE + obj * zswap_class_size(c);
+}
 
-typedef struct{
-  L2Table *tables[L1_ENTRIES];
-} L1Table;
+// Forgets the pool copy of slot, if there is one.
+static void zswap_drop(uint32_t slot){
+  if (!zswap.mem || !zswap.entries[slot].len)
+    return;
+  ZswapEntry *e = &zswap.entries[slot];
+  uint32_t p = e->handle / PAGE_SIZE;
+  int c = zswap.page_class[p];
+  bool was_full = !zswap.page_free[p];
+  zswap.page_free[p] |= 1ULL << (e->handle % PAGE_SIZE / zswap_class_size(c));
+  if (zswap.page_free[p] == zswap_full_mask(c)){
+    if (!was_full)
+      zswap_partial_del(c, p);
+    zswap.page_class[p] = -1;
+    zswap.page_next[p]  = zswap.free_pages;
+    zswap.free_pages    = p;
+    stats.zswap_pool_pages--;
+  } else if (was_full){
+    zswap_partial_add(c, p);
+  }
 
-typedef struct{
-  uint32_t page_faults;
-  uint32_t reads;
-  uint32_t writes;
-  uint32_t translation_failures;
-} VMStats;
+  if (e->prev >= 0)  zswap.entries[e->prev].next = e->next;
+  else               zswap.lru_head = e->next;
+  if (e->next >= 0)  zswap.entries[e->next].prev = e->prev;
+  else               zswap.lru_tail = e->prev;
+  e->len = 0;
+}
+
+static int zswap_load(uint32_t slot, uint8_t *buf){
+  ZswapEntry *e = &zswap.entries[slot];
+  return lz_decompress(zswap.mem + e->handle, e->len, buf);
+}
 
+// Moves the oldest pool entry out to its slot in the swap file.
+static int zswap_writeback(void){
+  uint8_t page[PAGE_SIZE];
+  int32_t slot = zswap.lru_head;
+  if (slot < 0 || zswap_load(slot, page) != 0 || swap_write(slot, page) != 0)
+    return -1;
+  zswap_drop(slot);
+  stats.zswap_writebacks++;
+  return 0;
+}
 
+static int zswap_store(uint32_t slot, const uint8_t *src){
+  uint8_t buf[ZSWAP_MAX_LEN];
+  uint32_t len = lz_compress(src, buf, sizeof(buf));
+  if (!len){
+    stats.zswap_rejects++;
+    return -1;
+  }
+  zswap_drop(slot);
+  int64_t handle;
+  while ((handle = zswap_alloc(len)) < 0){
+    if (zswap_writeback() != 0)
+      return -1;
+  }
+  memcpy(zswap.mem + handle, buf, len);
 
-uint8_t RAM[RAM_SIZE];
-L1Table page_table;
-bool phys_pages_used[NUM_PHYS_PAGES];
-VMStats stats;
+  ZswapEntry *e = &zswap.entries[slot];
+  e->handle = handle;
+  e->len    = len;
+  e->prev   = zswap.lru_tail;
+  e->next   = -1;
+  if (zswap.lru_tail >= 0)  zswap.entries[zswap.lru_tail].next = slot;
+  else                      zswap.lru_head = slot;
+  zswap.lru_tail = slot;
+  stats.zswap_stores++;
+  stats.zswap_in_bytes  += PAGE_SIZE;
+  stats.zswap_out_bytes += len;
+  return 0;
+}
 
-int page_fault_handler(uint16_t virt_page);
-int allocate_phys_page(void);
+// Saves the frame's contents under slot, in the pool if it takes them.
+static int swap_store(uint32_t slot, int frame){
+  const uint8_t *src = &RAM[(uint64_t)frame * PAGE_SIZE];
+  if (zswap.mem && zswap_store(slot, src) == 0)
+    return 0;
+  zswap_drop(slot);
+  return swap_write(slot, src);
+}
 
+static int swap_load(uint32_t slot, int frame){
+  uint8_t *dst = &RAM[(uint64_t)frame * PAGE_SIZE];
+  if (!zswap.mem || !zswap.entries[slot].len)
+    return swap_read(slot, dst);
+  uint64_t start = now_ns();
+  int rc = zswap_load(slot, dst);
+  stats.zswap_decompress_ns += now_ns() - start;
+  stats.zswap_loads++;
+  return rc;
+}
 
-void init_vm(void){
-  memset(&page_table, 0, sizeof(page_table));
-  memset(phys_pages_used, 0, sizeof(phys_pages_used));
-  memset(&stats, 0, sizeof(stats));
+// Drops one reference to slot, freeing it with the last.
+static void swap_free_slot(uint32_t slot){
+  uint32_t c = slot / SWAP_CLUSTER_PAGES;
+  if (swap.slot_refs[slot] > 1){
+    swap.slot_refs[slot]--;
+    return;
+  }
+  zswap_drop(slot);
+  if (bitmap_test(&swap.free_slots, slot))
+    return;
+  swap.slot_refs[slot] = 0;
+  bitmap_set(&swap.free_slots, slot);
+  if (++swap.cluster_free[c] == swap_cluster_size(c))
+    swap.free_clusters++;
 }
 
+/*
+ * Replacement policies. CLOCK relies on the accessed bit alone; FIFO and
+ * LRU keep mapped frames on an intrusive list through FrameDesc.prev/next,
+ * oldest (or least recently used) at the head.
+ */
+static uint32_t clock_hand;
+static int list_head = -1, list_tail = -1;
+static uint64_t random_state;
 
+static void clock_init(void){
+  clock_hand = 0;
+}
 
+// Sweep the hand, giving any page with PTE_ACCESSED set a second chance by
+// clearing the bit. Two sweeps are enough to find a victim if one exists.
+static int clock_pick_victim(void){
+  for (uint32_t n = 0; n < 2 * num_phys_pages; n++){
+    uint32_t f = clock_hand;
+    clock_hand = (clock_hand + 1) % num_phys_pages;
+    PTEntry *pte = frames[f].pte;
+    if (!pte || frames[f].pins)
+      continue;
+    if (pte->flags & PTE_ACCESSED){
+      pte->flags &= ~PTE_ACCESSED;
+      continue;
+    }
+    return f;
+  }
+  return -1;
+}
 
-L2Table* allocate_L2(){
-  L2Table *t = malloc(sizeof(L2Table));
-  if (!t){
-    fprintf(stderr, "ERROR: mem alloc failed\n");
-    return NULL;
+static void list_init(void){
+  list_head = list_tail = -1;
+}
+
+static void frame_list_add(int *head, int *tail, int frame){
+  frames[frame].prev = *tail;
+  frames[frame].next = -1;
+  if (*tail >= 0)  frames[*tail].next = frame;
+  else             *head = frame;
+  *tail = frame;
+}
+
+static void frame_list_del(int *head, int *tail, int frame){
+  int prev = frames[frame].prev, next = frames[frame].next;
+  if (prev >= 0)  frames[prev].next = next;
+  else            *head = next;
+  if (next >= 0)  frames[next].prev = prev;
+  else            *tail = prev;
+}
+
+static void list_append(int frame){
+  frame_list_add(&list_head, &list_tail, frame);
+}
+
+static void list_remove(int frame){
+  frame_list_del(&list_head, &list_tail, frame);
+}
+
+static void lru_on_access(int frame){
+  if (frame != list_tail){
+    list_remove(frame);
+    list_append(frame);
   }
-  for (int i = 0; i < L2_ENTRIES; i++){
-    t->entries[i].phys_page = -1;
-    t->entries[i].flags     = 0;
+}
+
+static int list_pick_victim(void){
+  for (int f = list_head; f >= 0; f = frames[f].next){
+    if (!frames[f].pins)
+      return f;
   }
-  return t;
+  return -1;
 }
 
-int allocate_phys_page(void){
-  for (int i = 0; i < NUM_PHYS_PAGES; i++){
-    if (!phys_pages_used[i]){
-      phys_pages_used[i] = true;
-      memset(&RAM[i*PAGE_SIZE], 0, PAGE_SIZE);
-      return i;
+static void random_init(void){
+  random_state = 0x9E3779B97F4A7C15ULL;
+}
+
+static int random_pick_victim(void){
+  for (uint32_t tries = 0; tries < num_phys_pages; tries++){
+    random_state ^= random_state << 13;  // xorshift64
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    uint32_t f = random_state % num_phys_pages;
+    if (frames[f].pte && !frames[f].pins)
+      return f;
+  }
+  for (uint32_t f = 0; f < num_phys_pages; f++){
+    if (frames[f].pte && !frames[f].pins)
+      return f;
+  }
+  return -1;
+}
+
+/*
+ * Multi-generational LRU. Each mapped frame sits on the list of its
+ * generation; new mappings join the youngest (max_seq). translate() only
+ * sets PTE_ACCESSED. Each eviction walks the next MGLRU_WALK_BATCH
+ * bottom-level tables of the page-table trees, resuming where the last one
+ * stopped, and moves every page whose bit is set into the youngest
+ * generation, so its cost is bounded and follows the number of mapped PTEs
+ * rather than the number of accesses. Aging just opens a new youngest
+ * generation. Eviction takes unreferenced pages from the oldest generation
+ * (min_seq); referenced ones found there are promoted instead.
+ */
+static uint64_t mglru_min_seq, mglru_max_seq;
+static int gen_head[MGLRU_GENS], gen_tail[MGLRU_GENS];
+static uint32_t mglru_space;   // space the walk is in, by ASID
+static uint64_t mglru_cursor;  // next bottom-level table (vpn >> PT_BITS) in it
+
+static void mglru_add(int frame, uint64_t seq){
+  frames[frame].gen = seq;
+  frame_list_add(&gen_head[seq % MGLRU_GENS], &gen_tail[seq % MGLRU_GENS], frame);
+}
+
+static void mglru_del(int frame){
+  uint32_t g = frames[frame].gen % MGLRU_GENS;
+  frame_list_del(&gen_head[g], &gen_tail[g], frame);
+}
+
+static void mglru_promote(int frame){
+  frames[frame].pte->flags &= ~PTE_ACCESSED;
+  mglru_del(frame);
+  mglru_add(frame, mglru_max_seq);
+  stats.mglru_promotions++;
+}
+
+static void mglru_init(void){
+  mglru_min_seq = mglru_max_seq = 0;
+  mglru_space = 0;
+  mglru_cursor = 0;
+  for (int g = 0; g < MGLRU_GENS; g++)
+    gen_head[g] = gen_tail[g] = -1;
+}
+
+static void mglru_on_map(int frame){
+  mglru_add(frame, mglru_max_seq);
+}
+
+// Walks the tables below t whose numbers are at least mglru_cursor, prefix
+// being t's number at its level, until *budget bottom-level tables are
+// done. Returns false if it stopped early.
+static bool mglru_walk(PageTable *t, int level, uint64_t prefix, uint32_t *budget){
+  if (level == PT_LEVELS - 1){
+    if (!*budget)
+      return false;
+    (*budget)--;
+    for (int i = 0; i < PT_ENTRIES; i++){
+      PTEntry *e = &t->entries[i];
+      if ((e->flags & (PTE_VALID | PTE_ACCESSED)) != (PTE_VALID | PTE_ACCESSED) ||
+          frames[e->phys_page].pte != e)
+        continue;
+      if (frames[e->phys_page].gen == mglru_max_seq)
+        e->flags &= ~PTE_ACCESSED;  // joined since the last aging; the bit is that first use
+      else
+        mglru_promote(e->phys_page);
+    }
+    stats.mglru_scanned += PT_ENTRIES;
+    mglru_cursor = prefix + 1;
+    return true;
+  }
+  int shift = PT_BITS * (PT_LEVELS - 2 - level);  // cursor bits below this level
+  int i = (mglru_cursor >> shift >> PT_BITS) == prefix ? (mglru_cursor >> shift) & (PT_ENTRIES - 1) : 0;
+  for (; i < PT_ENTRIES; i++){
+    PageTable *next = t->entries[i].next;
+    if (next && !mglru_walk(next, level + 1, (prefix << PT_BITS) | i, budget))
+      return false;
+  }
+  return true;
+}
+
+// Ages the next MGLRU_WALK_BATCH bottom-level tables, moving on through
+// the spaces by ASID as each one is finished.
+static void mglru_walk_step(void){
+  uint32_t budget = MGLRU_WALK_BATCH;
+  for (int n = 0; n < VM_MAX_SPACES; n++){
+    VMSpace *space = spaces[mglru_space];
+    bool left = !(mglru_cursor >> (PT_BITS * (PT_LEVELS - 1)));  // past the last table
+    if (space && space->root && left && !mglru_walk(space->root, 0, 0, &budget))
+      return;
+    mglru_space = (mglru_space + 1) % VM_MAX_SPACES;
+    mglru_cursor = 0;
+  }
+}
+
+static int mglru_pick_victim(void){
+  mglru_walk_step();
+  for (int round = 0; round < MGLRU_GENS + 2; round++){
+    if (mglru_max_seq - mglru_min_seq < 2){
+      mglru_max_seq++;
+      stats.mglru_agings++;
+    }
+    uint32_t g = mglru_min_seq % MGLRU_GENS;
+    for (int f = gen_head[g], next; f >= 0; f = next){
+      next = frames[f].next;
+      if (frames[f].pins)
+        continue;
+      if (!(frames[f].pte->flags & PTE_ACCESSED))
+        return f;
+      mglru_promote(f);
     }
+    // only pinned frames are left; carry them into the next generation
+    int f;
+    while ((f = gen_head[g]) >= 0){
+      mglru_del(f);
+      mglru_add(f, mglru_min_seq + 1);
+    }
+    mglru_min_seq++;
   }
   return -1;
 }
 
+const ReplacementPolicy policy_clock  = { "clock",  clock_init,  NULL, NULL, NULL, clock_pick_victim };
+const ReplacementPolicy policy_fifo   = { "fifo",   list_init,   list_append, NULL, list_remove, list_pick_victim };
+const ReplacementPolicy policy_lru    = { "lru",    list_init,   list_append, lru_on_access, list_remove, list_pick_victim };
+const ReplacementPolicy policy_random = { "random", random_init, NULL, NULL, NULL, random_pick_victim };
+const ReplacementPolicy policy_mglru  = { "mglru",  mglru_init,  mglru_on_map, NULL, mglru_del, mglru_pick_victim };
 
-void free_phys_page(int phys_page){
-  if (phys_page >= 0 && phys_page < NUM_PHYS_PAGES){
-    phys_pages_used[phys_page] = false;
+static void swap_out_finish(int frame, uint32_t slot){
+  PTEntry *pte = frames[frame].pte;
+  int32_t i = frames[frame].rmap, last = -1;
+  for (; i >= 0; last = i, i = rmap.entries[i].next){
+    RMapEntry *r = &rmap.entries[i];
+    r->pte->phys_page = slot;
+    r->pte->flags     = (r->pte->flags & ~(PTE_VALID | PTE_DIRTY)) | PTE_SWAPPED;
+    tlb_invalidate_asid(r->space->asid, r->vpn);
+    swap.slot_refs[slot]++;
   }
+  if (last >= 0){
+    rmap.entries[last].next = rmap.free;
+    rmap.free = frames[frame].rmap;
+  }
+  frames[frame].rmap = -1;
+  frames[frame].refs = 1;
+  pte->phys_page = slot;
+  pte->flags     = (pte->flags & ~(PTE_VALID | PTE_DIRTY)) | PTE_SWAPPED;
+  tlb_invalidate_asid(frames[frame].space->asid, frames[frame].vpn);
+  vm_event(VM_EV_SWAP_OUT, frames[frame].vpn << PAGE_SHIFT, frame);
+  frames[frame].swap_slot = -1;  // now owned by the PTE
+  frame_untrack(frame);
+  free_phys_page(frame);
 }
 
+/*
+ * Evicts up to swap.batch victims, returning how many went. A page that
+ * came in from swap keeps its slot until it is evicted or unmapped, so if
+ * it was never written the copy on disk is still good and eviction needs
+ * no I/O; dirty ones are written back to that slot. The rest get new slots
+ * from the current cluster, which are consecutive, and each run of them
+ * that zswap does not take goes to the file in one writev().
+ */
+static uint32_t swap_out_batch(void){
+  int victims[SWAP_BATCH_MAX];
+  int64_t slots[SWAP_BATCH_MAX];
+  uint32_t n = 0;
+  for (; n < swap.batch; n++){
+    int f = policy->pick_victim();
+    if (f < 0)
+      break;
+    frames[f].pins++;  // so the next pick passes over it
+    victims[n] = f;
+  }
+
+  struct iovec iov[SWAP_BATCH_MAX];
+  uint32_t run[SWAP_BATCH_MAX], nrun = 0;  // victims[] indices of the pending run
+  for (uint32_t i = 0; i <= n; i++){
+    int f = i < n ? victims[i] : -1;
+    int64_t slot = f >= 0 ? frames[f].swap_slot : -1;
+    if (slot >= 0 && swap.slot_refs[slot] > 1 && (frames[f].pte->flags & PTE_DIRTY)){
+      swap_free_slot(slot);  // a clone still needs the old contents
+      frames[f].swap_slot = slot = -1;
+    }
+    bool fresh = f >= 0 && slot < 0;
+    if (fresh)
+      slot = swap_alloc_slot();
+    // a run ends at the last victim or when the next new slot does not follow on
+    if (nrun && (f < 0 || !fresh || slot != slots[run[0]] + nrun)){
+      int rc = swap_write_run(slots[run[0]], iov, nrun);
+      for (uint32_t k = 0; k < nrun; k++){
+        if (rc == 0){
+          stats.dirty_evictions++;
+        } else {
+          swap_free_slot(slots[run[k]]);
+          slots[run[k]] = -1;
+        }
+      }
+      nrun = 0;
+    }
+    if (f < 0)
+      break;
+    slots[i] = slot;
+    if (slot < 0)
+      continue;
+    if (!fresh){
+      if (!(frames[f].pte->flags & PTE_DIRTY))
+        stats.clean_evictions++;
+      else if (swap_store(slot, f) == 0)
+        stats.dirty_evictions++;
+      else
+        slots[i] = -1;
+      continue;
+    }
+    uint8_t *src = &RAM[(uint64_t)f * PAGE_SIZE];
+    if (zswap.mem && zswap_store(slot, src) == 0){
+      stats.dirty_evictions++;
+      continue;
+    }
+    iov[nrun].iov_base = src;
+    iov[nrun].iov_len  = PAGE_SIZE;
+    run[nrun++] = i;
+  }
+
+  uint32_t evicted = 0;
+  for (uint32_t i = 0; i < n; i++){
+    frames[victims[i]].pins--;
+    if (slots[i] >= 0){
+      swap_out_finish(victims[i], slots[i]);
+      evicted++;
+    }
+  }
+  return evicted;
+}
 
+// A free frame, paging others out if RAM is full.
+static int alloc_frame(bool zeroed){
+  int f;
+  while ((f = zeroed ? allocate_phys_page() : alloc_phys_pages(0)) < 0){
+    if (swap.file && swap_out_batch() > 0)
+      continue;
+    if (!io.inflight)
+      return -1;
+    io_reap(true);  // everything else is pinned by page-ins
+  }
+  return f;
+}
 
-int map_page(uint16_t virt_page, uint16_t phys_page, uint8_t flags){
-  if (virt_page >= (L1_ENTRIES * L2_ENTRIES)){
-    fprintf(stderr, "ERROR: virt page 0x%x oob\n", virt_page);
+static int swap_in(PTEntry *pte, uint64_t virt_page, int frame){
+  uint32_t slot = pte->phys_page;
+  if (swap_load(slot, frame) != 0){
+    free_phys_page(frame);
     return -1;
   }
+  pte->phys_page = frame;
+  pte->flags     = (pte->flags & ~PTE_SWAPPED) | PTE_VALID;
+  frame_track(frame, cur_space, pte, virt_page);
+  frames[frame].swap_slot = slot;
+  vm_event(VM_EV_SWAP_IN, virt_page << PAGE_SHIFT, frame);
+  return 0;
+}
+
+static void *io_worker(void *arg){
+  (void)arg;
+  int fd = swap.fd;
+  pthread_mutex_lock(&io.lock);
+  for (;;){
+    while (!io.stop && io.queue_head == io.queue_tail)
+      pthread_cond_wait(&io.work_cv, &io.lock);
+    if (io.stop)
+      break;
+    int frame = io.queue[io.queue_tail++ % num_phys_pages];
+    off_t off = (off_t)frames[frame].swap_slot * PAGE_SIZE;
+    pthread_mutex_unlock(&io.lock);
+
+    ssize_t n = pread(fd, &RAM[(uint64_t)frame * PAGE_SIZE], PAGE_SIZE, off);
+
+    pthread_mutex_lock(&io.lock);
+    io.done[io.done_head++ % num_phys_pages] = (IOCompletion){ frame, n == PAGE_SIZE ? 0 : -1 };
+    pthread_cond_signal(&io.done_cv);
+  }
+  pthread_mutex_unlock(&io.lock);
+  return NULL;
+}
+
+static void io_destroy(void){
+  if (io.nthreads){
+    pthread_mutex_lock(&io.lock);
+    io.stop = true;
+    pthread_cond_broadcast(&io.work_cv);
+    pthread_mutex_unlock(&io.lock);
+    for (uint32_t i = 0; i < io.nthreads; i++)
+      pthread_join(io.threads[i], NULL);
+    pthread_mutex_destroy(&io.lock);
+    pthread_cond_destroy(&io.work_cv);
+    pthread_cond_destroy(&io.done_cv);
+  }
+  free(io.threads);
+  free(io.queue);
+  free(io.done);
+  memset(&io, 0, sizeof(io));
+}
 
+static int io_init(uint32_t nthreads){
+  if (!nthreads)
+    return 0;
+  io.threads = calloc(nthreads, sizeof(pthread_t));
+  io.queue   = malloc(num_phys_pages * sizeof(int));
+  io.done    = malloc(num_phys_pages * sizeof(IOCompletion));
+  if (!io.threads || !io.queue || !io.done){
+    io_destroy();
+    return -1;
+  }
+  pthread_mutex_init(&io.lock, NULL);
+  pthread_cond_init(&io.work_cv, NULL);
+  pthread_cond_init(&io.done_cv, NULL);
+  for (; io.nthreads < nthreads; io.nthreads++){
+    if (pthread_create(&io.threads[io.nthreads], NULL, io_worker, NULL) != 0){
+      io_destroy();
+      return -1;
+    }
+  }
+  return 0;
+}
 
-  if (phys_page >= NUM_PHYS_PAGES){
-    fprintf(stderr, "ERROR: phys page %d oob\n", phys_page);
+// Starts reading the swapped page behind entry into a fresh frame. The
+// entry becomes PTE_LOCKED with phys_page naming that frame until reaped.
+static int swap_in_async(PTEntry *entry, uint64_t virt_page){
+  stats.page_faults++;
+  vm_event(VM_EV_PAGE_FAULT, virt_page << PAGE_SHIFT, -1);
+  int frame = alloc_frame(false);
+  if (frame < 0){
+    vm_event(VM_EV_OUT_OF_MEMORY, virt_page << PAGE_SHIFT, -1);
     return -1;
   }
-  uint8_t l1 = (virt_page >> 4) & 0xf;
-  uint8_t l2 = virt_page & 0xf;
+  vm_event(VM_EV_PAGE_ALLOC, virt_page << PAGE_SHIFT, frame);
+  frames[frame].vpn       = virt_page;
+  frames[frame].space     = cur_space;
+  frames[frame].swap_slot = entry->phys_page;
+  frames[frame].in_io     = true;
+  frames[frame].pins++;
+  entry->phys_page = frame;
+  entry->flags     = (entry->flags & ~PTE_SWAPPED) | PTE_LOCKED;
+
+  pthread_mutex_lock(&io.lock);
+  io.queue[io.queue_head++ % num_phys_pages] = frame;
+  pthread_cond_signal(&io.work_cv);
+  pthread_mutex_unlock(&io.lock);
+  io.inflight++;
+  stats.async_swap_ins++;
+  return frame;
+}
+
+// Installs finished page-ins and moves their waiters to the ready list.
+// With wait set, blocks for at least one completion if any are in flight.
+static void io_reap(bool wait){
+  for (;;){
+    pthread_mutex_lock(&io.lock);
+    while (wait && io.inflight && io.done_head == io.done_tail)
+      pthread_cond_wait(&io.done_cv, &io.lock);
+    if (io.done_head == io.done_tail){
+      pthread_mutex_unlock(&io.lock);
+      return;
+    }
+    IOCompletion c = io.done[io.done_tail++ % num_phys_pages];
+    pthread_mutex_unlock(&io.lock);
+    wait = false;
+
+    FrameDesc *desc = &frames[c.frame];
+    PTEntry *entry  = pt_lookup_in(desc->space, desc->vpn);
+    uint32_t slot   = desc->swap_slot;
+    desc->in_io = false;
+    desc->pins--;
+    io.inflight--;
+    if (c.result == 0){
+      entry->phys_page = c.frame;
+      entry->flags     = (entry->flags & ~PTE_LOCKED) | PTE_VALID;
+      frame_track(c.frame, desc->space, entry, desc->vpn);
+      desc->swap_slot = slot;
+      vm_event(VM_EV_SWAP_IN, desc->vpn << PAGE_SHIFT, c.frame);
+      stats.swap_ins++;
+      stats.swap_in_bytes += PAGE_SIZE;
+    } else {
+      entry->phys_page = slot;
+      entry->flags     = (entry->flags & ~PTE_LOCKED) | PTE_SWAPPED;
+      desc->swap_slot = -1;
+      free_phys_page(c.frame);
+    }
+
+    VMRequest *w = desc->waiters;
+    if (w){
+      if (io.ready_tail)  io.ready_tail->next = w;
+      else                io.ready_head = w;
+      while (w->next)
+        w = w->next;
+      io.ready_tail = w;
+      desc->waiters = NULL;
+    }
+  }
+}
+
+static void io_wait_frame(int frame){
+  while (frames[frame].in_io)
+    io_reap(true);
+}
 
-  if (page_table.tables[l1] == NULL){
-    page_table.tables[l1] = allocate_L2();
-    if (!page_table.tables[l1])
+// Adds a region covering npages virtual pages from start. Regions may not
+// overlap. Returns the region index, or -1.
+int vm_region_add(const VMRegionConfig *cfg){
+  if (nregions == VM_MAX_REGIONS || !cfg->npages || cfg->start >= NUM_VIRT_PAGES ||
+      cfg->npages > NUM_VIRT_PAGES - cfg->start ||
+      cfg->fault_around & (cfg->fault_around - 1) || cfg->fault_around > PT_ENTRIES)
+    return -1;
+  for (uint32_t i = 0; i < nregions; i++){
+    if (cfg->start < regions[i].cfg.start + regions[i].cfg.npages &&
+        regions[i].cfg.start < cfg->start + cfg->npages)
       return -1;
   }
+  memset(&regions[nregions], 0, sizeof(VMRegion));
+  regions[nregions].cfg = *cfg;
+  return nregions++;
+}
+
+static VMRegion* region_find(uint64_t vpn){
+  for (uint32_t i = 0; i < nregions; i++){
+    if (vpn - regions[i].cfg.start < regions[i].cfg.npages)
+      return &regions[i];
+  }
+  return &default_region;
+}
 
-  page_table.tables[l1]->entries[l2].phys_page 	= phys_page;
-  page_table.tables[l1]->entries[l2].flags			=	flags | PTE_VALID;
-	phys_pages_used[phys_page] = true;
+// Brings virt_page in ahead of use: swapped pages are read back, empty
+// ones get a zeroed frame. Present pages are left alone. Returns -1 when
+// no frame could be had.
+static int populate_page(uint64_t virt_page){
+  PTEntry *entry = pt_lookup(virt_page);
+  if (entry && (entry->flags & (PTE_VALID | PTE_LOCKED)))
+    return 0;
+  bool swapped = entry && (entry->flags & PTE_SWAPPED);
+  int frame = alloc_frame(!swapped);
+  if (frame < 0)
+    return -1;
+  if (swapped ? swap_in(entry, virt_page, frame) != 0
+              : map_frame(virt_page, frame, PTE_READ | PTE_WRITE) != 0)
+    return -1;
+  pt_lookup(virt_page)->flags |= PTE_SPECULATIVE;
+  stats.readahead_pages++;
   return 0;
 }
 
-int translate(uint32_t vaddr, uint32_t *out_paddr, bool is_write){
-  if (vaddr >= RAM_SIZE){
-		fprintf(stderr, "ERROR: virt address 0x%x exceeds addr space\n", vaddr);
-		stats.translation_failures++;
-		return -1;
-	}
-	uint8_t l1 = (vaddr >> 16) & 0xf;
-  uint8_t l2 = (vaddr >> 12) & 0xf;
-  uint16_t off=(vaddr & 0xfff);
-  L2Table *t = page_table.tables[l1];
-  if (!t){
-		stats.translation_failures++;
-		return -1;
-	}
+// Sequential-stream detection. A fault on the page right after the last
+// one brought in continues a stream: the window starts at RA_INITIAL_WINDOW
+// and doubles each time the stream reaches its end, up to the region's
+// readahead_max. Pages evicted or unmapped untouched halve it again.
+static void readahead(uint64_t virt_page){
+  VMRegion *r = region_find(virt_page);
+  if (!r->cfg.readahead_max)
+    return;
+  if (virt_page != r->next_fault){
+    r->ra_window  = 0;
+    r->next_fault = virt_page + 1;
+    return;
+  }
+  if (!r->ra_window)
+    r->ra_window = RA_INITIAL_WINDOW;
+  else
+    r->ra_window *= 2;
+  if (r->ra_window > r->cfg.readahead_max)
+    r->ra_window = r->cfg.readahead_max;
 
-  L2Entry *entry 	= &t->entries[l2];
-	int phys_page 	=	entry->phys_page;
-  if (phys_page < 0 || !(entry->flags & PTE_VALID)){
-		stats.translation_failures++;
-		return -1;
-	}
+  uint64_t end = r->cfg.start + r->cfg.npages;
+  uint64_t vp  = virt_page + 1;
+  for (; vp <= virt_page + r->ra_window && vp < end; vp++){
+    if (populate_page(vp) != 0)
+      break;
+  }
+  r->next_fault = vp;
+}
 
-	if (is_write && !(entry->flags & PTE_WRITE)){
-		fprintf(stderr, "ERROR: write perm denied at addr 0x%x\n", vaddr);
-		stats.translation_failures++;
-		return -2;
-	}
-	if (!is_write && !(entry->flags & PTE_READ)){
-		stats.translation_failures++;
-		return -2;
-	}
-	uint32_t paddr = phys_page * PAGE_SIZE + off;
-	if (paddr >= RAM_SIZE){
-		fprintf(stderr, "ERROR: phys addr 0x%x oob\n", paddr);
-		stats.translation_failures++;
-		return -1;
-	}
-  *out_paddr = paddr;
-  return 0;
+// Up to n zeroed frames for a batch of mappings, taken as one buddy block
+// (surplus frames go straight back) when RAM has one. Never evicts.
+static uint32_t alloc_frames_batch(int *out, uint32_t n){
+  uint32_t order = 0;
+  while ((1u << order) < n)
+    order++;
+  int block = alloc_phys_pages(order);
+  if (block >= 0){
+    memset(&RAM[(uint64_t)block * PAGE_SIZE], 0, (size_t)n * PAGE_SIZE);
+    for (uint32_t i = n; i < (1u << order); i++)
+      free_phys_pages(block + i, 0);
+    for (uint32_t i = 0; i < n; i++)
+      out[i] = block + i;
+    return n;
+  }
+  uint32_t got = 0;
+  for (; got < n; got++){
+    int f = allocate_phys_page();
+    if (f < 0)
+      break;
+    out[got] = f;
+  }
+  return got;
 }
 
-int unmap_page(uint16_t virt_page){
-	if (virt_page >= (L1_ENTRIES * L2_ENTRIES)){
-		return -1;
-	}
+// Maps every empty entry in the aligned fault_around window around
+// virt_page, which was just mapped. The window never crosses a bottom-level
+// table, so the entries are found without further walks. Swapped entries
+// are left to readahead.
+static void fault_around(uint64_t virt_page){
+  VMRegion *r = region_find(virt_page);
+  uint32_t w = r->cfg.fault_around;
+  if (w < 2)
+    return;
+  uint64_t first = virt_page & ~(uint64_t)(w - 1);
+  uint64_t last  = first + w;
+  if (first < r->cfg.start)                    first = r->cfg.start;
+  if (last > r->cfg.start + r->cfg.npages)     last  = r->cfg.start + r->cfg.npages;
 
-	uint8_t l1 = (virt_page >> 4) & 0xf;
-	uint8_t l2 = virt_page & 0xf;
-	L2Table *t = page_table.tables[l1];
-	if (!t)	return -1;
+  PageTable *t = pt_table_at(virt_page, PT_LEVELS - 1);
+  uint64_t todo[PT_ENTRIES];
+  int batch[PT_ENTRIES];
+  uint32_t n = 0;
+  for (uint64_t vp = first; vp < last; vp++){
+    if (t->entries[pt_index(vp, PT_LEVELS - 1)].flags == 0)
+      todo[n++] = vp;
+  }
+  if (n == 0)
+    return;
+  n = alloc_frames_batch(batch, n);
+  for (uint32_t i = 0; i < n; i++){
+    if (map_frame(todo[i], batch[i], PTE_READ | PTE_WRITE) != 0){
+      free_phys_page(batch[i]);
+      continue;
+    }
+    t->entries[pt_index(todo[i], PT_LEVELS - 1)].flags |= PTE_FAULT_AROUND;
+    stats.fault_around_pages++;
+  }
+}
 
-	int phys_page = t->entries[l2].phys_page;
-	if (phys_page >= 0){
-		free_phys_page(phys_page);
-	}
-	t->entries[l2].phys_page = -1;
-	t->entries[l2].flags = 0;
-	return 0;
+// Write to a PTE_COW page. The zero page is replaced by a zeroed frame and
+// a frame still shared is copied into a private one; the last mapping left
+// just takes the frame back.
+static int cow_fault(PTEntry *entry, uint64_t virt_page){
+  int old = entry->phys_page;
+  bool zero = (uint32_t)old == zero_frame;
+  if (zero || frames[old].refs > 1){
+    frames[old].pins++;
+    int frame = alloc_frame(zero);
+    frames[old].pins--;
+    if (frame < 0){
+      vm_event(VM_EV_OUT_OF_MEMORY, virt_page << PAGE_SHIFT, -1);
+      return -1;
+    }
+    vm_event(VM_EV_PAGE_ALLOC, virt_page << PAGE_SHIFT, frame);
+    if (zero){
+      stats.zero_page_upgrades++;
+    } else {
+      memcpy(&RAM[(uint64_t)frame * PAGE_SIZE], &RAM[(uint64_t)old * PAGE_SIZE], PAGE_SIZE);
+      frame_put(old, entry);
+      stats.cow_copies++;
+    }
+    entry->phys_page = frame;
+    frame_track(frame, cur_space, entry, virt_page);
+  } else {
+    stats.cow_reuses++;
+  }
+  frames[entry->phys_page].ksm_hash = 0;  // about to change; needs two scans again
+  entry->flags = (entry->flags & ~PTE_COW) | PTE_WRITE;
+  tlb_invalidate(virt_page);
+  return 0;
+}
+
+// Read fault on an empty entry: map the shared zero page, copy-on-write.
+static int map_zero_page(uint64_t virt_page){
+  PageTable *t = pt_table_at(virt_page, PT_LEVELS - 1);
+  if (!t)
+    return -1;
+  PTEntry *entry = &t->entries[pt_index(virt_page, PT_LEVELS - 1)];
+  entry->phys_page = zero_frame;
+  entry->flags     = PTE_VALID | PTE_READ | PTE_COW;
+  t->used++;
+  tlb_invalidate(virt_page);
+  stats.zero_page_maps++;
+  return 0;
 }
 
-int page_fault_handler(uint16_t virt_page){
+static int handle_fault(uint64_t virt_page, bool is_write){
 	stats.page_faults++;
-	printf("page fault: virt page 0x%x\n", virt_page);
+	vm_event(VM_EV_PAGE_FAULT, virt_page << PAGE_SHIFT, -1);
 
-	int phys_page = allocate_phys_page();
+	PTEntry *entry = pt_lookup(virt_page);
+	if (entry && (entry->flags & PTE_LOCKED)){
+		stats.io_waits++;
+		io_wait_frame(entry->phys_page);
+		if (!(entry->flags & PTE_VALID))
+			return -1;
+		return is_write && (entry->flags & PTE_COW) ? cow_fault(entry, virt_page) : 0;
+	}
+	if (entry && (entry->flags & (PTE_VALID | PTE_COW)) == (PTE_VALID | PTE_COW))
+		return cow_fault(entry, virt_page);
+	if (!is_write && (!entry || !entry->flags) && virt_page < NUM_VIRT_PAGES)
+		return map_zero_page(virt_page);
+	bool swapped = entry && (entry->flags & PTE_SWAPPED);
+	int phys_page = alloc_frame(!swapped);
 	if (phys_page < 0){
-		fprintf(stderr, "ERROR: oopm\n");
+		vm_event(VM_EV_OUT_OF_MEMORY, virt_page << PAGE_SHIFT, -1);
 		return -1;
 	}
-	printf("	-> allocated physical page %d\n", phys_page);
-	return map_page(virt_page, phys_page, PTE_READ | PTE_WRITE);
-}
-int write_vmem(uint32_t vaddr, uint8_t val){
-  uint32_t paddr;
-  int res = translate(vaddr, &paddr, true);
-	if (res == -1){
-		uint16_t virt_page = vaddr >> 12;
-		if (page_fault_handler(virt_page) != 0)	return -1;
-		res = translate(vaddr, &paddr, true);
+	vm_event(VM_EV_PAGE_ALLOC, virt_page << PAGE_SHIFT, phys_page);
+	int res = swapped ? swap_in(entry, virt_page, phys_page)
+	                  : map_frame(virt_page, phys_page, PTE_READ | PTE_WRITE);
+	if (res == 0 && swapped && is_write && (entry->flags & PTE_COW))
+		res = cow_fault(entry, virt_page);  // still shared through the slot
+	if (res == 0){
+		frames[phys_page].pins++;  // keep readahead from evicting it
+		fault_around(virt_page);
+		readahead(virt_page);
+		frames[phys_page].pins--;
+	}
+	return res;
+}
+
+int page_fault_handler(uint64_t virt_page){
+	return handle_fault(virt_page, true);
+}
+
+// translate, taking a page fault and retrying once if the page is unmapped
+static int translate_or_fault(uint64_t vaddr, uint64_t *paddr, bool is_write){
+  int res = translate(vaddr, paddr, is_write);
+	if (res == -1 && !(vaddr >> VA_BITS)){
+		uint64_t virt_page = vaddr >> PAGE_SHIFT;
+		if (handle_fault(virt_page, is_write) != 0)	return -1;
+		res = translate_once(vaddr, paddr, is_write);
 	}
-	if (res != 0)
+	return res;
+}
+
+int write_vmem(uint64_t vaddr, uint8_t val){
+  uint64_t paddr;
+	if (translate_or_fault(vaddr, &paddr, true) != 0)
 		return -1;
 	RAM[paddr] = val;
 	stats.writes++;
 	return 0;
 }
 
-int read_vmem(uint32_t vaddr, uint8_t *out){
-  uint32_t paddr;
-  int res = translate(vaddr, &paddr, false);
-	if (res == -1){
-		uint16_t virt_page = vaddr >> 12;
-		if (page_fault_handler(virt_page) != 0)	return -1;
-		res = translate(vaddr, &paddr, false);
-	}
-	if (res != 0)	return -1;
+int read_vmem(uint64_t vaddr, uint8_t *out){
+  uint64_t paddr;
+	if (translate_or_fault(vaddr, &paddr, false) != 0)	return -1;
   *out = RAM[paddr];
 	stats.reads++;
   return 0;
 }
 
+// Copies len bytes one page-sized chunk at a time, translating once per page.
+// *done (may be NULL) gets the number of bytes copied before any failure.
+int write_vmem_range(uint64_t vaddr, const uint8_t *buf, size_t len, size_t *done){
+  size_t n = 0;
+  int res = 0;
+  while (n < len){
+    uint64_t paddr;
+    size_t chunk = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+    if (chunk > len - n)  chunk = len - n;
+    res = translate_or_fault(vaddr, &paddr, true);
+    if (res != 0)  break;
+    memcpy(&RAM[paddr], buf + n, chunk);
+    stats.writes += chunk;
+    vaddr += chunk;
+    n += chunk;
+  }
+  if (done)  *done = n;
+  return res;
+}
+
+int read_vmem_range(uint64_t vaddr, uint8_t *buf, size_t len, size_t *done){
+  size_t n = 0;
+  int res = 0;
+  while (n < len){
+    uint64_t paddr;
+    size_t chunk = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+    if (chunk > len - n)  chunk = len - n;
+    res = translate_or_fault(vaddr, &paddr, false);
+    if (res != 0)  break;
+    memcpy(buf + n, &RAM[paddr], chunk);
+    stats.reads += chunk;
+    vaddr += chunk;
+    n += chunk;
+  }
+  if (done)  *done = n;
+  return res;
+}
+
+// Multi-byte accesses in host byte order. An access inside one page costs a
+// single translation; a page-crossing one translates both pages before
+// touching RAM so a failing store leaves memory unchanged.
+static int access_vmem_n(uint64_t vaddr, void *val, size_t n, bool is_write){
+  uint64_t paddr, paddr2;
+  size_t first = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+  if (translate_or_fault(vaddr, &paddr, is_write) != 0)
+    return -1;
+  if (first >= n){
+    if (is_write)  memcpy(&RAM[paddr], val, n);
+    else           memcpy(val, &RAM[paddr], n);
+  } else {
+    // the second fault must not evict the first page
+    uint32_t pinned = paddr / PAGE_SIZE;
+    frames[pinned].pins++;
+    int res = translate_or_fault(vaddr + first, &paddr2, is_write);
+    frames[pinned].pins--;
+    if (res != 0)
+      return -1;
+    if (is_write){
+      memcpy(&RAM[paddr], val, first);
+      memcpy(&RAM[paddr2], (uint8_t *)val + first, n - first);
+    } else {
+      memcpy(val, &RAM[paddr], first);
+      memcpy((uint8_t *)val + first, &RAM[paddr2], n - first);
+    }
+  }
+  if (is_write)  stats.writes += n;
+  else           stats.reads += n;
+  return 0;
+}
+
+int read_vmem_u16(uint64_t vaddr, uint16_t *out){ return access_vmem_n(vaddr, out, 2, false); }
+int read_vmem_u32(uint64_t vaddr, uint32_t *out){ return access_vmem_n(vaddr, out, 4, false); }
+int read_vmem_u64(uint64_t vaddr, uint64_t *out){ return access_vmem_n(vaddr, out, 8, false); }
+int write_vmem_u16(uint64_t vaddr, uint16_t val){ return access_vmem_n(vaddr, &val, 2, true); }
+int write_vmem_u32(uint64_t vaddr, uint32_t val){ return access_vmem_n(vaddr, &val, 4, true); }
+int write_vmem_u64(uint64_t vaddr, uint64_t val){ return access_vmem_n(vaddr, &val, 8, true); }
+
+static void free_table(PageTable *t, int level){
+  if (level < PT_LEVELS - 1){
+    for (int i = 0; i < PT_ENTRIES; i++){
+      if (t->entries[i].next)
+        free_table(t->entries[i].next, level + 1);
+    }
+  }
+  free(t);
+  stats.pt_tables--;
+}
+
 void
 free_pages(void){
-  for (int i = 0; i < L1_ENTRIES; i++){
-    if (page_table.tables[i] == NULL)  continue;
-    free(page_table.tables[i]);
-		page_table.tables[i] = NULL;
+  while (io.inflight || io.ready_head)
+    vm_poll(true);
+  for (int a = 0; a < VM_MAX_SPACES; a++){
+    if (spaces[a] && spaces[a]->root)
+      free_table(spaces[a]->root, 0);
+    if (spaces[a] && spaces[a] != &default_space)
+      free(spaces[a]);
+    spaces[a] = NULL;
+  }
+  default_space.root = NULL;
+  spaces[0] = cur_space = &default_space;
+  if (frames)
+    memset(frames, 0, (num_phys_pages + 1) * sizeof(FrameDesc));
+  if (policy)
+    policy->init();
+  tlb_flush();
+}
+
+
+/*
+ * Address spaces. Each space has its own page-table tree and an ASID, the
+ * lowest one free. Switching only changes which tree and which TLB tag the
+ * access path uses; translations cached for other spaces stay where they
+ * are and hit again when their space comes back.
+ */
+VMSpace* vm_space_current(void){
+  return cur_space;
+}
+
+// A new, empty space, or NULL if VM_MAX_SPACES are already alive.
+VMSpace* vm_space_create(void){
+  for (int a = 1; a < VM_MAX_SPACES; a++){
+    if (spaces[a])
+      continue;
+    VMSpace *space = calloc(1, sizeof(VMSpace));
+    if (!space)
+      return NULL;
+    space->asid = a;
+    spaces[a] = space;
+    return space;
+  }
+  return NULL;
+}
+
+int vm_space_switch(VMSpace *space){
+  if (!space || spaces[space->asid] != space)
+    return -1;
+  if (space != cur_space){
+    cur_space = space;
+    stats.context_switches++;
+  }
+  return 0;
+}
+
+// Releases every frame, superpage and swap slot the tree below t holds.
+static void space_release(PageTable *t, int level, uint64_t vpn){
+  for (int i = 0; i < PT_ENTRIES; i++){
+    PTEntry *e = &t->entries[i];
+    uint64_t v = (vpn << PT_BITS) | i;
+    if (e->next){
+      space_release(e->next, level + 1, v);
+    } else if (e->flags & PTE_VALID){
+      bool huge = e->flags & PTE_HUGE;
+      if (huge)
+        stats.superpages--;
+      if (huge || frame_put(e->phys_page, e))
+        free_phys_pages(e->phys_page, huge ? SUPERPAGE_ORDER : 0);
+    } else if (e->flags & PTE_SWAPPED){
+      swap_free_slot(e->phys_page);
+    }
+  }
+}
+
+// Frees a space and everything mapped in it. The default space and the
+// current one cannot be destroyed.
+int vm_space_destroy(VMSpace *space){
+  if (!space || space == &default_space || space == cur_space ||
+      spaces[space->asid] != space)
+    return -1;
+  while (io.inflight || io.ready_head)
+    vm_poll(true);
+  if (space->root){
+    space_release(space->root, 0, 0);
+    free_table(space->root, 0);
+  }
+  tlb_flush_asid(space->asid);  // the ASID may be handed out again
+  spaces[space->asid] = NULL;
+  free(space);
+  return 0;
+}
+
+// Copies the tree below src into dst. 4 KB frames and swap slots are
+// shared, with writable pages turned copy-on-write on both sides;
+// superpages are copied. Each entry is counted as it is copied, so a
+// partial copy can be torn down like any other space.
+static int clone_table(VMSpace *space, PageTable *dst, PageTable *src, uint64_t vpn){
+  for (int i = 0; i < PT_ENTRIES; i++){
+    PTEntry *s = &src->entries[i], *d = &dst->entries[i];
+    uint64_t v = (vpn << PT_BITS) | i;
+    if (!s->flags && !s->next)
+      continue;
+    if (s->next){
+      if (!(d->next = allocate_table()))
+        return -1;
+      dst->used++;
+      if (clone_table(space, d->next, s->next, v) != 0)
+        return -1;
+      continue;
+    }
+    if (s->flags & PTE_HUGE){
+      int block = alloc_phys_pages(SUPERPAGE_ORDER);
+      if (block < 0)
+        return -1;
+      memcpy(&RAM[(uint64_t)block * PAGE_SIZE], &RAM[(uint64_t)s->phys_page * PAGE_SIZE],
+             (size_t)SUPERPAGE_PAGES * PAGE_SIZE);
+      d->phys_page = block;
+      stats.superpages++;
+    } else if (s->flags & PTE_VALID){
+      if ((uint32_t)s->phys_page != zero_frame){
+        if (rmap_reserve() != 0)
+          return -1;
+        frame_share(s->phys_page, space, d, v);
+      }
+      // map_page() aliases promise one memory to every mapping; they stay
+      // pinned and writable in both spaces
+      if ((s->flags & PTE_WRITE) && !frames[s->phys_page].aliased)
+        s->flags = (s->flags & ~PTE_WRITE) | PTE_COW;
+      d->phys_page = s->phys_page;
+    } else if (s->flags & PTE_SWAPPED){
+      swap.slot_refs[s->phys_page]++;
+      d->phys_page = s->phys_page;
+    }
+    d->flags = s->flags & (PTE_VALID | PTE_READ | PTE_WRITE | PTE_HUGE | PTE_SWAPPED | PTE_COW);
+    dst->used++;
+    stats.clone_ptes++;
   }
+  return 0;
 }
 
+// A new space mapping the same pages as the current one, at the cost of
+// copying its page tables. NULL if no ASID or memory is left.
+VMSpace* vm_clone(void){
+  while (io.inflight || io.ready_head)
+    vm_poll(true);  // no PTE_LOCKED entries to share
+  VMSpace *child = vm_space_create();
+  if (!child)
+    return NULL;
+  stats.clones++;
+  if (cur_space->root){
+    tlb_flush_asid(cur_space->asid);  // cached entries may still allow writes
+    if (!(child->root = allocate_table()) ||
+        clone_table(child, child->root, cur_space->root, 0) != 0){
+      vm_space_destroy(child);
+      return NULL;
+    }
+  }
+  return child;
+}
 
 void
 print_stats(void){
@@ -239,12 +2889,130 @@ print_stats(void){
 	printf("%-12s:  %u\n", "Reads", stats.reads);
 	printf("%-12s:  %u\n", "Writes",stats.writes);
 	printf("%-12s:  %u\n", "Trans fails",stats.translation_failures);
-	int used_pages= 0;
-	for (int i = 0; i < NUM_PHYS_PAGES; i++){
-		if (phys_pages_used[i])	used_pages++;
+	printf("%-12s:  %u / %u (%u evicted)\n", "TLB hit/miss",
+	       stats.tlb_hits, stats.tlb_misses, stats.tlb_evictions);
+	printf("%-12s:  %u\n", "Ev dropped", stats.events_dropped);
+	int used_pages = num_phys_pages - free_frames.count - zero_pool.count;
+printf("%-12s:  %d / %u\n", "PHY used",  used_pages, num_phys_pages);
+	printf("%-12s:  %u\n", "PT tables", stats.pt_tables);
+	printf("%-12s:  %s\n", "Policy", policy->name);
+	if (stats.context_switches)
+		printf("%-12s:  %u switches, %u TLB hits across a switch\n", "Spaces",
+		       stats.context_switches, stats.tlb_reuse_hits);
+	if (stats.zero_page_maps)
+		printf("%-12s:  %u read faults mapped, %u replaced on write\n", "Zero page",
+		       stats.zero_page_maps, stats.zero_page_upgrades);
+	if (stats.ksm_scanned)
+		printf("%-12s:  %llu scanned, %u merged (%u into the zero page), %llu bytes saved\n", "KSM",
+		       (unsigned long long)stats.ksm_scanned, stats.ksm_merges, stats.ksm_zero_merges,
+		       (unsigned long long)stats.ksm_merges * PAGE_SIZE);
+	if (stats.clones)
+		printf("%-12s:  %u clones (%llu PTEs), %u copied / %u reused on write\n", "COW",
+		       stats.clones, (unsigned long long)stats.clone_ptes, stats.cow_copies, stats.cow_reuses);
+	if (swap.file)
+		printf("%-12s:  %u in / %u out (%llu / %llu bytes), %u / %u slots free\n", "Swap",
+		       stats.swap_ins, stats.swap_outs, (unsigned long long)stats.swap_in_bytes,
+		       (unsigned long long)stats.swap_out_bytes, swap.free_slots.count, swap.free_slots.nbits);
+	if (swap.file)
+		printf("%-12s:  %u clean / %u dirty\n", "Evictions",
+		       stats.clean_evictions, stats.dirty_evictions);
+	if (swap.file)
+		printf("%-12s:  %u / %u free, %u opened, %u slots outside clusters, %.0f%% fragmented, %u batch writes\n",
+		       "Clusters", swap.free_clusters, swap.nclusters, stats.swap_cluster_allocs,
+		       stats.swap_frag_allocs, 100.0 * swap_fragmentation(), stats.swap_batch_writes);
+	if (stats.mglru_agings)
+		printf("%-12s:  %u agings, %u promotions, %llu PTEs scanned, gens %llu-%llu\n", "MGLRU",
+		       stats.mglru_agings, stats.mglru_promotions, (unsigned long long)stats.mglru_scanned,
+		       (unsigned long long)mglru_min_seq, (unsigned long long)mglru_max_seq);
+	if (wss.nsamples)
+		printf("%-12s:  %u / %u / %u pages over %llu / %llu / %llu accesses\n", "WSS",
+		       vm_wss(0), vm_wss(1), vm_wss(2), (unsigned long long)wss.windows[0],
+		       (unsigned long long)wss.windows[1], (unsigned long long)wss.windows[2]);
+	if (stats.readahead_pages)
+		printf("%-12s:  %u pages, %u hit, %u wasted\n", "Readahead",
+		       stats.readahead_pages, stats.readahead_hits, stats.readahead_waste);
+	if (stats.fault_around_pages)
+		printf("%-12s:  %u pages, %u touched\n", "Fault-around",
+		       stats.fault_around_pages, stats.fault_around_hits);
+	if (io.nthreads)
+		printf("%-12s:  %u async page-ins, %u joined in flight\n", "Async I/O",
+		       stats.async_swap_ins, stats.io_waits);
+	if (zswap.mem){
+		printf("%-12s:  %u stored / %u loaded / %u written back / %u rejected\n", "Zswap",
+		       stats.zswap_stores, stats.zswap_loads, stats.zswap_writebacks, stats.zswap_rejects);
+		printf("%-12s:  %.2fx ratio, %u / %u pool pages, %llu ns avg decompress\n", "",
+		       stats.zswap_out_bytes ? (double)stats.zswap_in_bytes / stats.zswap_out_bytes : 0.0,
+		       stats.zswap_pool_pages, zswap.npages,
+		       (unsigned long long)(stats.zswap_loads ? stats.zswap_decompress_ns / stats.zswap_loads : 0));
 	}
-printf("%-12s:  %d / %d\n", "PHY used",  used_pages, NUM_PHYS_PAGES);
+	printf("%-12s:  %u / %u (%u hits, %u misses)\n", "Zero pool", zero_pool.count,
+	       zero_pool.capacity, stats.zero_pool_hits, stats.zero_pool_misses);
+	printf("%-12s: ", "Free blocks");
+	for (int k = 0; k <= BUDDY_MAX_ORDER; k++)
+		printf(" %u", stats.free_blocks[k]);
+	printf("\n");
+}
+static void vm_complete(VMRequest *req){
+  VMSpace *cur = cur_space;
+  cur_space = req->space;  // not a context switch, just finishing its access
+  req->result = req->is_write ? write_vmem(req->vaddr, req->value)
+                              : read_vmem(req->vaddr, &req->value);
+  cur_space = cur;
+  if (req->done)
+    req->done(req);
+}
+
+// Starts an access without blocking on swap I/O. Returns 0 if the request
+// completed (done has run), 1 if it waits on a page-in and will complete
+// in a later vm_poll(). Requests for a page already being read in share
+// that read.
+int vm_submit(VMRequest *req){
+  req->next  = NULL;
+  req->space = cur_space;
+  // a plain lookup, so the access is counted once, when it completes
+  if (io.nthreads && !(req->vaddr >> VA_BITS)){
+    uint64_t virt_page = req->vaddr >> PAGE_SHIFT;
+    PTEntry *entry = pt_lookup(virt_page);
+    int frame = -1;
+    if (entry && (entry->flags & PTE_LOCKED)){
+      frame = entry->phys_page;
+      stats.io_waits++;
+    } else if (entry && (entry->flags & PTE_SWAPPED) &&
+               !(zswap.mem && zswap.entries[entry->phys_page].len)){
+      frame = swap_in_async(entry, virt_page);
+    }
+    if (frame >= 0){
+      VMRequest **w = &frames[frame].waiters;
+      while (*w)
+        w = &(*w)->next;
+      *w = req;
+      return 1;
+    }
+  }
+  vm_complete(req);
+  return 0;
 }
+
+// Reaps finished page-ins and completes the requests waiting on them. With
+// wait set, blocks until at least one page-in finishes if any are in flight.
+// Returns the number of requests completed.
+int vm_poll(bool wait){
+  int n = 0;
+  if (!io.nthreads)
+    return 0;
+  io_reap(wait);
+  while (io.ready_head){
+    VMRequest *req = io.ready_head;
+    io.ready_head = req->next;
+    if (!io.ready_head)
+      io.ready_tail = NULL;
+    req->next = NULL;
+    vm_complete(req);
+    n++;
+  }
+  return n;
+}
+
 /*int main(){
   uint8_t RO = PTE_READ;
   uint8_t WO = PTE_WRITE;
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L  // clock_gettime, before any system header
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -86,8 +87,8 @@ void test_bounds_checking(void) {
     TEST_START("Bounds Checking");
     init_vm();
     
-    // Invalid virtual address (beyond 1MB)
-    int result = write_vmem(0x200000, 0x11);
+    // Invalid virtual address (beyond 48 bits)
+    int result = write_vmem(1ULL << VA_BITS, 0x11);
     ASSERT(result != 0, "Reject address beyond virtual space");
     
     // Invalid physical page in manual mapping
@@ -95,7 +96,7 @@ void test_bounds_checking(void) {
     ASSERT(result != 0, "Reject invalid physical page");
     
     // Invalid virtual page
-    result = map_page(0xFFF, 30, PTE_READ | PTE_WRITE);
+    result = map_page(NUM_VIRT_PAGES, 30, PTE_READ | PTE_WRITE);
     ASSERT(result != 0, "Reject invalid virtual page");
     
     free_pages();
@@ -197,7 +198,7 @@ void test_physical_memory_exhaustion(void) {
     
     // Try to allocate all physical pages
     int allocated = 0;
-    for (int i = 0; i < NUM_PHYS_PAGES + 10; i++) {
+    for (int i = 0; i < num_phys_pages + 10; i++) {
         uint32_t addr = i * PAGE_SIZE;
         if (write_vmem(addr, i & 0xFF) == 0) {
             allocated++;
@@ -206,10 +207,10 @@ void test_physical_memory_exhaustion(void) {
         }
     }
     
-    ASSERT(allocated == NUM_PHYS_PAGES, "Allocated all available physical pages");
+    ASSERT(allocated == num_phys_pages, "Allocated all available physical pages");
     
     // Next allocation should fail
-    int result = write_vmem((NUM_PHYS_PAGES + 1) * PAGE_SIZE, 0x99);
+    int result = write_vmem((num_phys_pages + 1) * PAGE_SIZE, 0x99);
     ASSERT(result != 0, "Allocation fails when memory exhausted");
     
     free_pages();
@@ -239,6 +240,1174 @@ void test_two_level_table_structure(void) {
     free_pages();
 }
 
+void test_tlb(void) {
+    TEST_START("TLB Caching");
+    VMConfig cfg = { .tlb_sets = 2, .tlb_ways = 2 };
+    init_vm_config(&cfg);
+    
+    map_page(0x07, 60, PTE_READ | PTE_WRITE);
+    uint8_t val;
+    read_vmem(0x007010, &val);
+    uint32_t old_hits = stats.tlb_hits;
+    read_vmem(0x007020, &val);
+    ASSERT(stats.tlb_hits == old_hits + 1, "Second access to a page hits the TLB");
+    
+    // More pages than the TLB holds forces evictions
+    for (uint32_t vp = 0; vp < 8; vp++) {
+        write_vmem(vp * PAGE_SIZE, vp);
+    }
+    ASSERT(stats.tlb_evictions > 0, "TLB evicts when a set is full");
+    
+    // Remapping must not leave a stale translation behind
+    write_vmem(0x007000, 0x55);
+    unmap_page(0x07);
+    map_page(0x07, 61, PTE_READ | PTE_WRITE);
+    RAM[61 * PAGE_SIZE] = 0x66;
+    read_vmem(0x007000, &val);
+    ASSERT(val == 0x66, "Unmap invalidates the cached translation");
+    
+    free_pages();
+}
+
+void test_range_access(void) {
+    TEST_START("Range Read/Write");
+    init_vm();
+    
+    // Spans three pages starting mid-page
+    static uint8_t src[2 * PAGE_SIZE + 100], dst[2 * PAGE_SIZE + 100];
+    for (size_t i = 0; i < sizeof(src); i++) src[i] = (uint8_t)(i * 7);
+    
+    size_t done = 0;
+    int result = write_vmem_range(0x020F80, src, sizeof(src), &done);
+    ASSERT(result == 0 && done == sizeof(src), "Range write covers all bytes");
+    ASSERT(stats.page_faults == 3, "One fault per page touched");
+    
+    uint32_t old_misses = stats.tlb_misses;
+    result = read_vmem_range(0x020F80, dst, sizeof(dst), &done);
+    ASSERT(result == 0 && memcmp(src, dst, sizeof(src)) == 0, "Range read returns written data");
+    ASSERT(stats.tlb_misses - old_misses <= 3, "At most one translation per page");
+    
+    // Stops at a read-only page and reports the partial count
+    map_page(0x31, 70, PTE_READ);
+    result = write_vmem_range(0x030FF0, src, 64, &done);
+    ASSERT(result != 0 && done == 16, "Partial write reports bytes done");
+    
+    free_pages();
+}
+
+void test_typed_access(void) {
+    TEST_START("Typed Multi-Byte Access");
+    init_vm();
+    
+    uint64_t v64 = 0;
+    int result = write_vmem_u64(0x040010, 0x1122334455667788ULL);
+    result |= read_vmem_u64(0x040010, &v64);
+    ASSERT(result == 0 && v64 == 0x1122334455667788ULL, "u64 round trip within a page");
+    
+    uint32_t old_misses = stats.tlb_misses;
+    uint32_t v32 = 0;
+    read_vmem_u32(0x040013, &v32);
+    ASSERT(stats.tlb_misses == old_misses, "Unaligned in-page load takes one lookup");
+    
+    // Straddles the 0x41/0x42 page boundary
+    uint16_t v16 = 0;
+    result = write_vmem_u32(0x041FFE, 0xCAFEBABE);
+    result |= read_vmem_u32(0x041FFE, &v32);
+    result |= read_vmem_u16(0x042000, &v16);
+    ASSERT(result == 0 && v32 == 0xCAFEBABE, "u32 round trip across a page boundary");
+    ASSERT(v16 == (uint16_t)(0xCAFEBABE >> 16), "Split write lands in both pages");
+    
+    // Second page read-only: the store must not be half applied
+    map_page(0x44, 80, PTE_READ);
+    write_vmem(0x043FFF, 0x00);
+    result = write_vmem_u16(0x043FFF, 0xFFFF);
+    uint8_t val;
+    read_vmem(0x043FFF, &val);
+    ASSERT(result != 0 && val == 0x00, "Failed split store leaves memory unchanged");
+    
+    free_pages();
+}
+
+void test_event_ring(void) {
+    TEST_START("Event Ring");
+    init_vm();
+    
+    write_vmem(0x050000, 0x01);
+    map_page(0x51, 90, PTE_READ);
+    write_vmem(0x051000, 0x02);
+    
+    VMEvent ev;
+    bool got_fault = false, got_alloc = false, got_denied = false;
+    while (vm_event_pop(&ev)) {
+        if (ev.type == VM_EV_PAGE_FAULT && ev.vaddr == 0x050000) got_fault = true;
+        if (ev.type == VM_EV_PAGE_ALLOC && ev.vaddr == 0x050000) got_alloc = true;
+        if (ev.type == VM_EV_WRITE_DENIED && ev.phys_page == 90) got_denied = true;
+    }
+    ASSERT(got_fault && got_alloc, "Fault and allocation recorded");
+    ASSERT(got_denied, "Write denial recorded with its frame");
+    
+    // Overflow drops new events instead of overwriting
+    for (int i = 0; i < EVENT_RING_SIZE + 10; i++) {
+        write_vmem(0x051000, 0x02);
+    }
+    ASSERT(vm_events_drain(NULL) == EVENT_RING_SIZE, "Ring holds a full buffer of events");
+    ASSERT(stats.events_dropped == 10, "Overflowing events are counted as dropped");
+    
+    free_pages();
+}
+
+void test_frame_bitmap(void) {
+    TEST_START("Bitmap Frame Allocator");
+    init_vm();
+    
+    ASSERT(free_frames.count == num_phys_pages, "All frames free after init");
+    
+    map_page(0x00, 0, PTE_READ | PTE_WRITE);
+    map_page(0x01, 1, PTE_READ | PTE_WRITE);
+    map_page(0x02, 70, PTE_READ | PTE_WRITE);
+    ASSERT(free_frames.count == num_phys_pages - 3, "Manual mappings reserve frames");
+    ASSERT(allocate_phys_page() == 2, "Allocator returns the lowest free frame");
+    
+    // Fill the first word so the search must move past it
+    for (int i = 3; i < 64; i++) allocate_phys_page();
+    ASSERT(allocate_phys_page() == 64, "Search continues into the next word");
+    
+    unmap_page(0x01);
+    ASSERT(allocate_phys_page() == 1, "Freed frame is found again");
+    ASSERT(free_frames.count == num_phys_pages - 66, "Free counter tracks every change");
+    
+    free_pages();
+}
+
+void test_buddy_allocator(void) {
+    TEST_START("Buddy Allocator");
+    init_vm();
+    
+    ASSERT(stats.free_blocks[8] == 1, "All of RAM starts as one order-8 block");
+    
+    int a = alloc_phys_pages(4);
+    int b = alloc_phys_pages(4);
+    ASSERT(a == 0 && b == 16, "Order-4 blocks are aligned and contiguous");
+    ASSERT(free_frames.count == num_phys_pages - 32, "Block frames marked in use");
+    
+    int c = allocate_phys_page();
+    ASSERT(c == 32, "Single frame split from the next free block");
+    ASSERT(alloc_phys_pages(9) < 0, "Order larger than RAM fails");
+    
+    free_phys_pages(a, 4);
+    ASSERT(stats.free_blocks[4] == 2, "Freed block not merged while buddy in use");
+    free_phys_pages(b, 4);
+    ASSERT(stats.free_blocks[5] == 1 && stats.free_blocks[4] == 1, "Freed buddies coalesce");
+    free_phys_page(c);
+    ASSERT(stats.free_blocks[8] == 1 && free_frames.count == num_phys_pages,
+           "Everything coalesces back into one block");
+    
+    free_pages();
+}
+
+void test_zero_pool(void) {
+    TEST_START("Pre-Zeroed Frame Pool");
+    VMConfig cfg = { .zero_pool_size = 4 };
+    init_vm_config(&cfg);
+    
+    ASSERT(zero_pool_refill(100) == 4, "Refill stops at pool capacity");
+    
+    write_vmem(0x060000, 0x12);
+    write_vmem(0x061000, 0x34);
+    ASSERT(stats.zero_pool_hits == 2 && stats.zero_pool_misses == 0, "Faults served from the pool");
+    
+    // Dirty a frame, free it, and make sure the pool hands out zeroes
+    unmap_page(0x60);
+    zero_pool_refill(4);
+    uint8_t val = 0xFF;
+    read_vmem(0x062000, &val);
+    ASSERT(val == 0, "Pooled frames are zero-filled");
+    
+    // Exhausting the pool falls back to synchronous zeroing
+    for (uint32_t vp = 0x63; vp < 0x6A; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    ASSERT(stats.zero_pool_misses > 0, "Empty pool falls back to memset");
+    
+    // Manually mapping a pooled frame takes it out of the pool
+    zero_pool_refill(4);
+    int pooled = zero_pool.frames[0];
+    map_page(0x70, pooled, PTE_READ | PTE_WRITE);
+    bool still_pooled = false;
+    for (uint32_t i = 0; i < zero_pool.count; i++)
+        if (zero_pool.frames[i] == pooled) still_pooled = true;
+    ASSERT(!still_pooled && zero_pool.count == 3, "map_page claims a pooled frame");
+    
+    // Raw allocations reclaim pooled frames once the buddy lists run dry
+    uint32_t avail = free_frames.count + zero_pool.count;
+    uint32_t got = 0;
+    while (alloc_phys_pages(0) >= 0) got++;
+    ASSERT(got == avail && zero_pool.count == 0, "Pool drained when RAM runs out");
+    
+    // With the buddy lists empty, refill has nothing to add
+    VMConfig tiny = { .ram_size = 8 * PAGE_SIZE, .zero_pool_size = 4 };
+    init_vm_config(&tiny);
+    zero_pool_refill(2);
+    while (free_frames.count) alloc_phys_pages(0);
+    ASSERT(zero_pool_refill(1000) == 0 && zero_pool.count == 2, "Refill reports only frames it added");
+    
+    free_pages();
+}
+
+void test_radix_table(void) {
+    TEST_START("4-Level Radix Table");
+    VMConfig cfg = { .ram_size = 4 << 20 };
+    init_vm_config(&cfg);
+    ASSERT(num_phys_pages == 1024, "RAM sized at init");
+    ASSERT(stats.pt_tables == 0, "No table memory before the first mapping");
+    
+    // Far-apart 48-bit addresses
+    uint64_t lo = 0x1000, hi = 0x7FFFFFFFF000ULL;
+    int result = write_vmem(lo, 0x5A) | write_vmem(hi + 0xFFF, 0xA5);
+    uint8_t v1 = 0, v2 = 0;
+    read_vmem(lo, &v1);
+    read_vmem(hi + 0xFFF, &v2);
+    ASSERT(result == 0 && v1 == 0x5A && v2 == 0xA5, "Low and high 48-bit addresses work");
+    ASSERT(stats.pt_tables == 1 + 2 * (PT_LEVELS - 1), "Interior tables allocated on demand");
+    
+    // A neighbour shares every table
+    write_vmem(hi - PAGE_SIZE, 0x01);
+    ASSERT(stats.pt_tables == 1 + 2 * (PT_LEVELS - 1), "Neighbouring page reuses its tables");
+    
+    // Unmapping the last pages of a subtree releases its tables
+    unmap_page(hi >> PAGE_SHIFT);
+    unmap_page((hi - PAGE_SIZE) >> PAGE_SHIFT);
+    ASSERT(stats.pt_tables == PT_LEVELS, "Emptied tables are freed");
+    
+    free_pages();
+    ASSERT(stats.pt_tables == 0, "free_pages releases every table");
+}
+
+void test_superpages(void) {
+    TEST_START("Superpage Mappings");
+    VMConfig cfg = { .ram_size = 8 << 20 };
+    init_vm_config(&cfg);
+    
+    int frame = alloc_phys_pages(SUPERPAGE_ORDER);
+    free_phys_pages(frame, SUPERPAGE_ORDER);
+    uint64_t vbase = 0x40000000ULL;  // 1 GB, 2 MB aligned
+    int result = map_superpage(vbase >> PAGE_SHIFT, frame, PTE_READ | PTE_WRITE);
+    ASSERT(result == 0, "Map a 2 MB superpage");
+    ASSERT(free_frames.count == num_phys_pages - SUPERPAGE_PAGES, "Superpage reserves its frames");
+    ASSERT(stats.pt_tables == PT_LEVELS - 1, "No bottom-level table allocated");
+    
+    write_vmem(vbase + 0x12345, 0x77);
+    ASSERT(RAM[(uint64_t)frame * PAGE_SIZE + 0x12345] == 0x77, "Offset lands in the contiguous frames");
+    
+    uint32_t old_misses = stats.tlb_misses;
+    uint8_t val;
+    for (uint32_t i = 0; i < SUPERPAGE_PAGES; i += 37) read_vmem(vbase + i * PAGE_SIZE, &val);
+    ASSERT(stats.tlb_misses == old_misses, "One TLB entry covers the whole superpage");
+    
+    result = map_page((vbase >> PAGE_SHIFT) + 3, 5, PTE_READ);
+    ASSERT(result != 0, "4 KB mapping inside a superpage rejected");
+    result = map_superpage((vbase >> PAGE_SHIFT) + 1, frame, PTE_READ);
+    ASSERT(result != 0, "Misaligned superpage rejected");
+    
+    // Only free frames can back a superpage; remapping releases the old block
+    int taken = alloc_phys_pages(SUPERPAGE_ORDER);
+    result = map_superpage((vbase >> PAGE_SHIFT) + SUPERPAGE_PAGES, taken, PTE_READ);
+    ASSERT(result != 0, "Allocated block rejected");
+    ASSERT(map_superpage((vbase >> PAGE_SHIFT) + SUPERPAGE_PAGES, frame, PTE_READ) != 0,
+           "Block owned by another superpage rejected");
+    free_phys_pages(taken, SUPERPAGE_ORDER);
+    ASSERT(map_superpage(vbase >> PAGE_SHIFT, frame, PTE_READ | PTE_WRITE) == 0 &&
+           free_frames.count == num_phys_pages - SUPERPAGE_PAGES, "Same block can be remapped");
+    ASSERT(map_superpage(vbase >> PAGE_SHIFT, taken, PTE_READ | PTE_WRITE) == 0 &&
+           free_frames.count == num_phys_pages - SUPERPAGE_PAGES && stats.superpages == 1,
+           "Remap frees the old block");
+    frame = taken;
+    
+    unmap_superpage(vbase >> PAGE_SHIFT);
+    ASSERT(free_frames.count == num_phys_pages && stats.pt_tables == 1,
+           "Unmap frees the frames and all but the root table");
+    ASSERT(read_vmem(vbase, &val) == 0 && val == 0, "Range faults in 4 KB pages afterwards");
+    
+    // The last superpage's TLB entry must go with it, even once another is mapped
+    init_vm_config(&cfg);
+    uint64_t va = 0x40000000ULL, vb = va + 4 * SUPERPAGE_PAGES * PAGE_SIZE;
+    int fa = alloc_phys_pages(SUPERPAGE_ORDER), fb = alloc_phys_pages(SUPERPAGE_ORDER);
+    free_phys_pages(fa, SUPERPAGE_ORDER);
+    free_phys_pages(fb, SUPERPAGE_ORDER);
+    map_superpage(va >> PAGE_SHIFT, fa, PTE_READ | PTE_WRITE);
+    write_vmem(va + 100, 0x11);
+    unmap_superpage(va >> PAGE_SHIFT);
+    map_superpage(vb >> PAGE_SHIFT, fb, PTE_READ | PTE_WRITE);
+    write_vmem(vb + 100, 0x22);
+    RAM[(uint64_t)fa * PAGE_SIZE + 100] = 0x33;
+    uint32_t faults = stats.page_faults;
+    ASSERT(read_vmem(va + 100, &val) == 0 && val == 0 && stats.page_faults == faults + 1,
+           "Unmapped superpage faults instead of hitting a stale entry");
+    
+    free_pages();
+}
+
+void test_swap(void) {
+    TEST_START("Swap Backend");
+    VMConfig cfg = { .ram_size = 16 * PAGE_SIZE, .swap_slots = 64 };
+    init_vm_config(&cfg);
+    
+    // Twice as many pages as RAM
+    bool all_written = true;
+    for (uint32_t vp = 0; vp < 32; vp++) {
+        if (write_vmem_u32(vp * PAGE_SIZE + 8, 0xC0DE0000 + vp) != 0) all_written = false;
+    }
+    ASSERT(all_written, "Writes beyond RAM size succeed");
+    ASSERT(stats.swap_outs >= 16, "Pages were swapped out");
+    
+    bool all_correct = true;
+    for (uint32_t vp = 0; vp < 32; vp++) {
+        uint32_t v = 0;
+        if (read_vmem_u32(vp * PAGE_SIZE + 8, &v) != 0 || v != 0xC0DE0000 + vp) all_correct = false;
+    }
+    ASSERT(all_correct, "Swapped pages read back intact");
+    ASSERT(stats.swap_ins > 0 && stats.swap_in_bytes == (uint64_t)stats.swap_ins * PAGE_SIZE,
+           "Swap-ins counted in pages and bytes");
+    
+    // Unmapping a swapped-out page releases its slot
+    uint32_t slots_free = swap.free_slots.count;
+    PTEntry *pte = pt_lookup(0);
+    bool was_swapped = pte && (pte->flags & PTE_SWAPPED);
+    unmap_page(0);
+    ASSERT(!was_swapped || swap.free_slots.count == slots_free + 1, "Unmap frees the swap slot");
+    
+    // Page-crossing access with both pages out of RAM
+    uint64_t v64 = 0;
+    write_vmem_u64(40 * PAGE_SIZE - 4, 0x0102030405060708ULL);
+    for (uint32_t vp = 1; vp < 32; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    read_vmem_u64(40 * PAGE_SIZE - 4, &v64);
+    ASSERT(v64 == 0x0102030405060708ULL, "Split access survives eviction between halves");
+    
+    free_pages();
+}
+
+void test_clock_replacement(void) {
+    TEST_START("CLOCK Replacement");
+    VMConfig cfg = { .ram_size = 8 * PAGE_SIZE, .swap_slots = 32 };
+    init_vm_config(&cfg);
+    
+    for (uint32_t vp = 0; vp < 8; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    PTEntry *hot = pt_lookup(3);
+    ASSERT(hot && (hot->flags & PTE_ACCESSED), "Access sets the accessed bit");
+    
+    // Each new page clears the bits it sweeps past; keep page 3 hot
+    bool hot_stayed = true;
+    for (uint32_t vp = 8; vp < 20; vp++) {
+        uint8_t val;
+        read_vmem(3 * PAGE_SIZE, &val);
+        write_vmem(vp * PAGE_SIZE, vp);
+        if (!(pt_lookup(3)->flags & PTE_VALID)) hot_stayed = false;
+    }
+    ASSERT(hot_stayed, "Recently used page survives eviction");
+    ASSERT(stats.swap_outs >= 12, "Cold pages were evicted instead");
+    
+    // TLB hits keep setting the bit once CLOCK has cleared it
+    uint8_t val;
+    read_vmem(3 * PAGE_SIZE, &val);
+    pt_lookup(3)->flags &= ~PTE_ACCESSED;
+    uint32_t old_hits = stats.tlb_hits;
+    read_vmem(3 * PAGE_SIZE, &val);
+    ASSERT(stats.tlb_hits == old_hits + 1 && (pt_lookup(3)->flags & PTE_ACCESSED),
+           "TLB hit sets the accessed bit");
+    
+    free_pages();
+}
+
+void test_policies(void) {
+    TEST_START("Replacement Policies");
+    const ReplacementPolicy *list[] = { &policy_fifo, &policy_lru, &policy_random, &policy_clock };
+    uint8_t val;
+    
+    // Page 0 is touched again before page 4 forces an eviction
+    for (int p = 0; p < 2; p++) {
+        VMConfig cfg = { .ram_size = 4 * PAGE_SIZE, .swap_slots = 16, .policy = list[p] };
+        init_vm_config(&cfg);
+        for (uint32_t vp = 0; vp < 4; vp++) write_vmem(vp * PAGE_SIZE, vp);
+        read_vmem(0, &val);
+        write_vmem(4 * PAGE_SIZE, 4);
+        if (p == 0) {
+            ASSERT(pt_lookup(0)->flags & PTE_SWAPPED, "FIFO evicts the oldest mapping");
+        } else {
+            ASSERT((pt_lookup(0)->flags & PTE_VALID) && (pt_lookup(1)->flags & PTE_SWAPPED),
+                   "LRU evicts the least recently used page");
+        }
+    }
+    
+    // Every policy keeps data intact while cycling through more pages than RAM
+    for (int p = 0; p < 4; p++) {
+        VMConfig cfg = { .ram_size = 4 * PAGE_SIZE, .swap_slots = 16, .policy = list[p] };
+        init_vm_config(&cfg);
+        for (uint32_t vp = 0; vp < 12; vp++) write_vmem(vp * PAGE_SIZE + 7, 0x40 + vp);
+        bool intact = true;
+        for (uint32_t vp = 0; vp < 12; vp++) {
+            if (read_vmem(vp * PAGE_SIZE + 7, &val) != 0 || val != 0x40 + vp) intact = false;
+        }
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%s round-trips pages through swap", list[p]->name);
+        ASSERT(intact && stats.swap_outs > 0, msg);
+    }
+    
+    free_pages();
+}
+
+void test_dirty_tracking(void) {
+    TEST_START("Dirty Bit Tracking");
+    VMConfig cfg = { .ram_size = 4 * PAGE_SIZE, .swap_slots = 16 };
+    init_vm_config(&cfg);
+    uint8_t val;
+    
+    write_vmem(0, 1);
+    ASSERT(pt_lookup(0)->flags & PTE_DIRTY, "Write sets the dirty bit");
+    for (uint32_t vp = 1; vp < 8; vp++) write_vmem(vp * PAGE_SIZE, vp + 1);
+    ASSERT(stats.dirty_evictions == stats.swap_outs && stats.clean_evictions == 0,
+           "Written pages are written back");
+    
+    // Once every page has been read back in, read-only churn needs no writes
+    for (uint32_t vp = 0; vp < 8; vp++) read_vmem(vp * PAGE_SIZE, &val);
+    uint32_t outs = stats.swap_outs;
+    bool intact = true;
+    for (int pass = 0; pass < 3; pass++) {
+        for (uint32_t vp = 0; vp < 8; vp++) {
+            if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != vp + 1) intact = false;
+        }
+    }
+    ASSERT(intact, "Pages dropped clean read back intact");
+    ASSERT(stats.swap_outs == outs && stats.clean_evictions > 0, "Clean evictions skip swap writes");
+    
+    // Writing a swapped-in page makes its swap copy stale
+    read_vmem(0, &val);
+    ASSERT(!(pt_lookup(0)->flags & PTE_DIRTY), "Swapped-in page starts clean");
+    write_vmem(0, 0x55);
+    for (uint32_t vp = 1; vp < 8; vp++) read_vmem(vp * PAGE_SIZE, &val);
+    ASSERT(stats.swap_outs == outs + 1, "Dirtied page is written back once");
+    read_vmem(0, &val);
+    ASSERT(val == 0x55, "Written-back data survives");
+    
+    free_pages();
+}
+
+// Fills a page with `noise` pseudo-random bytes followed by a repeating pattern
+static void fill_page(uint8_t *page, uint32_t seed, uint32_t noise) {
+    uint32_t x = seed * 2654435761u + 1;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        page[i] = i < noise ? (uint8_t)x : (uint8_t)(seed + i % 7);
+    }
+}
+
+void test_zswap(void) {
+    TEST_START("Compressed Swap Cache");
+    uint8_t page[PAGE_SIZE], buf[PAGE_SIZE], out[PAGE_SIZE];
+    
+    bool roundtrip = true;
+    uint32_t noise[] = { 0, 1, 100, 1000, 3000 };
+    for (int i = 0; i < 5; i++) {
+        fill_page(page, i + 1, noise[i]);
+        uint32_t len = lz_compress(page, buf, sizeof(buf));
+        if (!len || lz_decompress(buf, len, out) != 0 || memcmp(page, out, PAGE_SIZE) != 0) roundtrip = false;
+    }
+    fill_page(page, 9, PAGE_SIZE);
+    ASSERT(roundtrip, "Compressor round-trips pages");
+    ASSERT(lz_compress(page, buf, ZSWAP_MAX_LEN) == 0, "Random data is rejected");
+    
+    VMConfig cfg = { .ram_size = 4 * PAGE_SIZE, .swap_slots = 32, .zswap_pages = 4 };
+    init_vm_config(&cfg);
+    for (uint32_t vp = 0; vp < 16; vp++) {
+        fill_page(page, vp, 64);
+        write_vmem_range(vp * PAGE_SIZE, page, PAGE_SIZE, NULL);
+    }
+    ASSERT(stats.zswap_stores >= 12 && stats.swap_outs == 0, "Compressible pages stay out of the file");
+    ASSERT(stats.zswap_in_bytes >= 3 * stats.zswap_out_bytes, "Compression ratio is tracked");
+    
+    bool intact = true;
+    for (uint32_t vp = 0; vp < 16; vp++) {
+        fill_page(page, vp, 64);
+        read_vmem_range(vp * PAGE_SIZE, out, PAGE_SIZE, NULL);
+        if (memcmp(page, out, PAGE_SIZE) != 0) intact = false;
+    }
+    ASSERT(intact && stats.zswap_loads > 0 && stats.swap_ins == 0, "Faults are served from the pool");
+    
+    // Pages that barely fit leave room for one object per pool page
+    init_vm_config(&cfg);
+    for (uint32_t vp = 0; vp < 16; vp++) {
+        fill_page(page, vp, vp % 4 == 0 ? PAGE_SIZE : 2000);
+        write_vmem_range(vp * PAGE_SIZE, page, PAGE_SIZE, NULL);
+    }
+    ASSERT(stats.zswap_rejects > 0, "Incompressible pages bypass the pool");
+    ASSERT(stats.zswap_writebacks > 0 && stats.zswap_pool_pages <= 4, "Full pool writes back its oldest entries");
+    intact = true;
+    for (uint32_t vp = 0; vp < 16; vp++) {
+        fill_page(page, vp, vp % 4 == 0 ? PAGE_SIZE : 2000);
+        read_vmem_range(vp * PAGE_SIZE, out, PAGE_SIZE, NULL);
+        if (memcmp(page, out, PAGE_SIZE) != 0) intact = false;
+    }
+    ASSERT(intact, "Pages read back intact from both tiers");
+    
+    for (uint32_t vp = 0; vp < 16; vp++) unmap_page(vp);
+    ASSERT(stats.zswap_pool_pages == 0 && swap.free_slots.count == 32, "Unmapping releases pool objects and slots");
+    
+    // Same-size objects pack into one page; a freed object is taken before a new page
+    cfg.swap_slots = 128;
+    init_vm_config(&cfg);
+    memset(page, 7, PAGE_SIZE);
+    uint32_t per_page = PAGE_SIZE / zswap_class_size((lz_compress(page, buf, ZSWAP_MAX_LEN) - 1) >> ZSWAP_CLASS_SHIFT);
+    bool packed = true;
+    for (uint32_t s = 0; s <= per_page; s++)
+        if (zswap_store(s, page) != 0) packed = false;
+    ASSERT(packed && stats.zswap_pool_pages == 2 && zswap.entries[per_page].handle == PAGE_SIZE,
+           "Objects of a class share pool pages");
+    uint32_t hole = zswap.entries[3].handle;
+    zswap_drop(3);
+    zswap_store(3, page);
+    ASSERT(zswap.entries[3].handle == hole && stats.zswap_pool_pages == 2, "Freed objects are reused first");
+    for (uint32_t s = 0; s <= per_page; s++) zswap_drop(s);
+    bool refill = stats.zswap_pool_pages == 0;
+    for (uint32_t s = 0; s < 4; s++) {
+        fill_page(page, s, 2500);
+        if (zswap_store(s, page) != 0) refill = false;
+    }
+    ASSERT(refill && stats.zswap_pool_pages == 4 && stats.zswap_writebacks == 0, "Emptied pages return to the pool");
+    
+    free_pages();
+}
+
+static void count_done(VMRequest *req) {
+    (*(int *)req->user)++;
+}
+
+void test_async_swap(void) {
+    TEST_START("Asynchronous Swap-In");
+    VMConfig cfg = { .ram_size = 8 * PAGE_SIZE, .swap_slots = 32, .io_threads = 2 };
+    init_vm_config(&cfg);
+    for (uint32_t vp = 0; vp < 16; vp++) write_vmem(vp * PAGE_SIZE + 5, 0x30 + vp);
+    
+    // Pages 0-7 were pushed out by 8-15
+    int completed = 0;
+    VMRequest reqs[8];
+    int pending = 0;
+    for (uint32_t vp = 0; vp < 4; vp++) {
+        reqs[vp] = (VMRequest){ .vaddr = vp * PAGE_SIZE + 5, .done = count_done, .user = &completed };
+        pending += vm_submit(&reqs[vp]);
+    }
+    ASSERT(pending == 4 && completed == 0 && stats.async_swap_ins == 4, "Swapped pages are read in the background");
+    
+    // A second request for page 0 and a synchronous read of page 1 share the reads in flight
+    reqs[4] = (VMRequest){ .vaddr = 5, .done = count_done, .user = &completed };
+    pending += vm_submit(&reqs[4]);
+    uint8_t val = 0;
+    read_vmem(PAGE_SIZE + 5, &val);
+    ASSERT(pending == 5 && val == 0x31 && stats.async_swap_ins == 4 && stats.io_waits == 2,
+           "Faults on a page in flight wait for the same read");
+    
+    while (completed < 5) vm_poll(true);
+    bool ok = true;
+    for (int i = 0; i < 5; i++) {
+        if (reqs[i].result != 0 || reqs[i].value != 0x30 + (reqs[i].vaddr >> PAGE_SHIFT)) ok = false;
+    }
+    ASSERT(ok && stats.swap_ins == 4, "Completions deliver the swapped-in data");
+    
+    // Resident pages complete immediately
+    reqs[5] = (VMRequest){ .vaddr = 2 * PAGE_SIZE + 5, .is_write = true, .value = 0x77, .done = count_done, .user = &completed };
+    uint32_t lookups = stats.tlb_hits + stats.tlb_misses;
+    uint64_t clock = vm_clock;
+    ASSERT(vm_submit(&reqs[5]) == 0 && completed == 6 && reqs[5].result == 0, "Resident page completes inline");
+    ASSERT(stats.tlb_hits + stats.tlb_misses == lookups + 1 && vm_clock == clock + 1, "Submitting counts one translation");
+    
+    // More page-ins than free frames
+    completed = 0;
+    for (uint32_t vp = 8; vp < 16; vp++) write_vmem(vp * PAGE_SIZE, 0);
+    for (uint32_t vp = 0; vp < 8; vp++) {
+        reqs[vp] = (VMRequest){ .vaddr = vp * PAGE_SIZE + 5, .done = count_done, .user = &completed };
+        vm_submit(&reqs[vp]);
+    }
+    while (completed < 8) vm_poll(true);
+    ok = true;
+    for (uint32_t vp = 0; vp < 8; vp++) {
+        if (reqs[vp].result != 0 || reqs[vp].value != (vp == 2 ? 0x77 : 0x30 + vp)) ok = false;
+    }
+    ASSERT(ok, "Page-ins beyond RAM size all complete");
+    
+    free_pages();
+}
+
+void test_readahead(void) {
+    TEST_START("Sequential Readahead");
+    VMConfig cfg = { .readahead_max = 16 };
+    init_vm_config(&cfg);
+    
+    for (uint32_t addr = 0; addr < 64 * PAGE_SIZE; addr += 256) write_vmem(addr, addr >> 8);
+    ASSERT(stats.page_faults < 16, "Sequential stream faults far less than once per page");
+    ASSERT(stats.readahead_hits + 16 >= stats.readahead_pages && stats.readahead_waste == 0,
+           "Only the last window runs past the stream");
+    bool ok = true;
+    for (uint32_t addr = 0; addr < 64 * PAGE_SIZE; addr += 256) {
+        uint8_t val;
+        if (read_vmem(addr, &val) != 0 || val != (uint8_t)(addr >> 8)) ok = false;
+    }
+    ASSERT(ok, "Data written through read-ahead pages is intact");
+    
+    // Strided faults never form a stream
+    uint32_t pages = stats.readahead_pages;
+    for (uint32_t vp = 100; vp < 200; vp += 3) write_vmem(vp * PAGE_SIZE, 1);
+    ASSERT(stats.readahead_pages == pages, "Non-sequential faults read nothing ahead");
+    
+    // Only the region opts in
+    init_vm();
+    VMRegionConfig rc = { .start = 1000, .npages = 64, .readahead_max = 8 };
+    ASSERT(vm_region_add(&rc) == 0, "Region added");
+    rc.start = 1050;
+    ASSERT(vm_region_add(&rc) == -1, "Overlapping region rejected");
+    for (uint32_t vp = 0; vp < 32; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    ASSERT(stats.page_faults == 32 && stats.readahead_pages == 0, "No readahead outside regions by default");
+    for (uint32_t vp = 1000; vp < 1064; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    ASSERT(stats.page_faults < 32 + 16 && !(pt_lookup(1064)->flags & PTE_VALID), "Region streams read ahead within the region only");
+    
+    // Streams through swap; pages pushed out before use count as waste
+    VMConfig small = { .ram_size = 16 * PAGE_SIZE, .swap_slots = 64, .readahead_max = 32 };
+    init_vm_config(&small);
+    for (uint32_t vp = 0; vp < 48; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    ok = true;
+    for (uint32_t vp = 0; vp < 48; vp++) {
+        uint8_t val;
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != vp) ok = false;
+    }
+    ASSERT(ok && stats.swap_ins > 0, "Readahead swaps pages back in");
+    ASSERT(stats.readahead_waste > 0 && stats.readahead_hits > 0, "Hits and waste are both tracked");
+    
+    free_pages();
+}
+
+void test_fault_around(void) {
+    TEST_START("Fault-Around");
+    VMConfig bad = { .fault_around = 12 };
+    ASSERT(init_vm_config(&bad) == -1, "Window must be a power of two");
+    VMConfig cfg = { .fault_around = 16 };
+    init_vm_config(&cfg);
+    
+    write_vmem(5 * PAGE_SIZE, 1);
+    ASSERT(stats.page_faults == 1 && stats.fault_around_pages == 15, "One fault maps the aligned window");
+    ASSERT((pt_lookup(0)->flags & PTE_VALID) && (pt_lookup(15)->flags & PTE_VALID) &&
+           !(pt_lookup(16)->flags & PTE_VALID), "Window is aligned to its size");
+    
+    uint8_t val = 0xFF;
+    read_vmem(3 * PAGE_SIZE, &val);
+    read_vmem(9 * PAGE_SIZE, &val);
+    ASSERT(stats.page_faults == 1 && val == 0 && stats.fault_around_hits == 2,
+           "Neighbours are zeroed and counted when touched");
+    
+    // Pages already present are left alone; only the holes are filled
+    map_page(20, 200, PTE_READ);
+    write_vmem(17 * PAGE_SIZE, 1);
+    ASSERT(stats.fault_around_pages == 15 + 14 && pt_lookup(20)->phys_page == 200,
+           "Present entries are skipped");
+    
+    // A full window allocates nothing, so the pool is not drained for it
+    unmap_page(5);
+    zero_pool_refill(4);
+    while (free_frames.count) alloc_phys_pages(0);
+    uint32_t pooled = zero_pool.count;
+    ASSERT(write_vmem(5 * PAGE_SIZE, 1) == 0 && zero_pool.count == pooled - 1,
+           "Nothing to fill around takes no frames");
+    
+    // A region can override the default window
+    init_vm();
+    VMRegionConfig rc = { .start = 64, .npages = 8, .fault_around = 32 };
+    ASSERT(vm_region_add(&rc) == 0, "Region with fault-around added");
+    write_vmem(0, 1);
+    ASSERT(stats.fault_around_pages == 0, "Default is off");
+    write_vmem(66 * PAGE_SIZE, 1);
+    ASSERT(stats.fault_around_pages == 7 && !(pt_lookup(72)->flags & PTE_VALID),
+           "Window is clipped to the region");
+    
+    free_pages();
+}
+
+void test_working_set(void) {
+    TEST_START("Working-Set Estimation");
+    VMConfig cfg = { .wss_interval = 1, .wss_windows = { 100, 1000, 10000 } };
+    init_vm_config(&cfg);
+    uint8_t val;
+    
+    for (uint32_t vp = 0; vp < 50; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    for (int i = 0; i < 2000; i++) read_vmem((i % 10) * PAGE_SIZE, &val);
+    ASSERT(vm_wss(0) == 10 && vm_wss(1) == 10, "Short windows see only the hot pages");
+    ASSERT(vm_wss(2) == 50, "Long window sees every page touched");
+    
+    // Steps are bounded by the batch size, not by RAM
+    uint64_t scanned = stats.wss_scanned;
+    read_vmem(0, &val);
+    ASSERT(stats.wss_scanned - scanned <= WSS_SCAN_BATCH, "One step examines at most one batch");
+    
+    FILE *f = tmpfile();
+    size_t n = vm_wss_export(f);
+    rewind(f);
+    char line[128];
+    int lines = 0;
+    bool header = fgets(line, sizeof(line), f) && strncmp(line, "timestamp,wss_100,", 18) == 0;
+    while (fgets(line, sizeof(line), f)) lines++;
+    fclose(f);
+    ASSERT(header && n == WSS_HISTORY && lines == WSS_HISTORY, "Export writes the retained samples");
+    
+    init_vm();
+    for (int i = 0; i < 1000; i++) read_vmem(0, &val);
+    ASSERT(stats.wss_scanned == 0 && vm_wss(0) == 0, "Scanner is off by default");
+    
+    free_pages();
+}
+
+// Hot set read every round while a stream of new pages is written behind it
+static uint32_t hot_refaults(const ReplacementPolicy *policy) {
+    VMConfig cfg = { .ram_size = 16 * PAGE_SIZE, .swap_slots = 512, .policy = policy };
+    init_vm_config(&cfg);
+    uint8_t val;
+    uint32_t next = 100;
+    for (uint32_t vp = 0; vp < 14; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    for (int round = 0; round < 100; round++) {
+        for (uint32_t vp = 0; vp < 14; vp++) read_vmem(vp * PAGE_SIZE, &val);
+        write_vmem(next++ * PAGE_SIZE, 1);
+        write_vmem(next++ * PAGE_SIZE, 1);
+    }
+    return stats.swap_ins;
+}
+
+void test_mglru(void) {
+    TEST_START("Multi-Generational LRU");
+    ASSERT(policy_mglru.on_access == NULL, "Accesses only set the PTE bit");
+    
+    VMConfig cfg = { .ram_size = 4 * PAGE_SIZE, .swap_slots = 16, .policy = &policy_mglru };
+    init_vm_config(&cfg);
+    for (uint32_t vp = 0; vp < 4; vp++) write_vmem(vp * PAGE_SIZE, vp + 1);
+    write_vmem(4 * PAGE_SIZE, 5);
+    ASSERT(stats.mglru_agings > 0 && stats.mglru_scanned % PT_ENTRIES == 0,
+           "Aging walks whole bottom-level tables");
+    
+    // A page referenced since the last aging outlives an idle one
+    uint8_t val;
+    ASSERT(!(pt_lookup(0)->flags & PTE_VALID), "Oldest idle page evicted first");
+    read_vmem(1 * PAGE_SIZE, &val);
+    write_vmem(5 * PAGE_SIZE, 6);
+    ASSERT((pt_lookup(1)->flags & PTE_VALID) && !(pt_lookup(2)->flags & PTE_VALID),
+           "Referenced page survives eviction");
+    ASSERT(stats.mglru_promotions > 0, "Referenced pages are promoted");
+    
+    bool ok = true;
+    for (uint32_t vp = 0; vp < 6; vp++) {
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != vp + 1) ok = false;
+    }
+    ASSERT(ok, "Data survives eviction through swap");
+    
+    // Cost follows mapped tables, not accesses
+    read_vmem(0, &val);
+    uint64_t scanned = stats.mglru_scanned;
+    for (int i = 0; i < 1000; i++) read_vmem(0, &val);
+    ASSERT(stats.mglru_scanned == scanned, "Repeated hits do no aging work");
+    
+    // Pages spread over many tables are aged a batch of tables per eviction
+    ok = true;
+    for (uint32_t t = 1; t <= 32; t++) {
+        scanned = stats.mglru_scanned;
+        write_vmem((uint64_t)t * PT_ENTRIES * PAGE_SIZE, 1);
+        if (stats.mglru_scanned - scanned > MGLRU_WALK_BATCH * PT_ENTRIES) ok = false;
+    }
+    ASSERT(ok && stats.mglru_agings > 2, "One eviction walks a bounded number of tables");
+    
+    // A one-pass stream does not wash out the hot set
+    uint32_t clock_refaults = hot_refaults(&policy_clock);
+    uint32_t mglru_refaults = hot_refaults(&policy_mglru);
+    ASSERT(mglru_refaults * 10 < clock_refaults, "Hot set resists a streaming scan");
+    
+    free_pages();
+}
+
+void test_swap_clusters(void) {
+    TEST_START("Clustered Swap Slots");
+    VMConfig bad = { .swap_slots = 64, .swap_batch = SWAP_BATCH_MAX + 1 };
+    ASSERT(init_vm_config(&bad) == -1, "Oversized batch rejected");
+    
+    VMConfig cfg = { .ram_size = 16 * PAGE_SIZE, .swap_slots = 4 * SWAP_CLUSTER_PAGES,
+                     .swap_batch = 8, .policy = &policy_fifo };
+    init_vm_config(&cfg);
+    for (uint32_t vp = 0; vp < 16; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    write_vmem(16 * PAGE_SIZE, 16);
+    ASSERT(stats.swap_outs == 8 && stats.swap_batch_writes == 1, "One fault evicts a batch in one write");
+    bool ok = true;
+    for (uint32_t vp = 0; vp < 8; vp++) {
+        PTEntry *e = pt_lookup(vp);
+        if (!(e->flags & PTE_SWAPPED) || e->phys_page != vp) ok = false;
+    }
+    ASSERT(ok, "Batch lands in consecutive slots");
+    ASSERT(stats.swap_cluster_allocs == 1 && swap.free_clusters == 3, "Batch fills one cluster");
+    
+    for (uint32_t vp = 17; vp < 64; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    ok = true;
+    for (uint32_t vp = 0; vp < 64; vp++) {
+        uint8_t val;
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != vp) ok = false;
+    }
+    ASSERT(ok, "Data survives batched write-out");
+    
+    // Dirty pages go back to their old slots one at a time, between batches
+    for (uint32_t round = 1; round <= 2; round++) {
+        for (uint32_t vp = 0; vp < 64; vp++) write_vmem(vp * PAGE_SIZE, (uint8_t)(vp + 100 * round));
+    }
+    ok = true;
+    for (uint32_t vp = 0; vp < 64; vp++) {
+        uint8_t val;
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != (uint8_t)(vp + 200)) ok = false;
+    }
+    ASSERT(ok && stats.swap_batch_writes > 1, "Single and batched writes agree on the file");
+    
+    // Holes left by unmapping show up as fragmentation, then get reused
+    for (uint32_t vp = 0; vp < 64; vp += 2) unmap_page(vp);
+    ASSERT(swap_fragmentation() > 0.0, "Scattered frees fragment clusters");
+    
+    // Once no cluster is empty, slots come from wherever one is free
+    VMConfig full = { .ram_size = 4 * PAGE_SIZE, .swap_slots = SWAP_CLUSTER_PAGES + 4 };
+    init_vm_config(&full);
+    for (uint32_t vp = 0; vp < SWAP_CLUSTER_PAGES + 8; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    ASSERT(swap.free_slots.count == 0 && swap.free_clusters == 0, "All slots in use");
+    unmap_page(3);
+    unmap_page(10);
+    write_vmem(100 * PAGE_SIZE, 1);
+    ASSERT(stats.swap_frag_allocs == 1 && swap.free_slots.count == 1, "Fallback takes a stray slot");
+    
+    free_pages();
+}
+
+void test_address_spaces(void) {
+    TEST_START("Address Spaces");
+    VMConfig cfg = { .ram_size = 64 * PAGE_SIZE, .swap_slots = 256 };
+    init_vm_config(&cfg);
+    VMSpace *a = vm_space_current();
+    VMSpace *b = vm_space_create();
+    ASSERT(b && b->asid != a->asid, "New space gets its own ASID");
+    
+    // Same virtual address, different pages
+    write_vmem(0x1000, 'A');
+    ASSERT(vm_space_switch(b) == 0, "Switch to the new space");
+    uint8_t val = 0;
+    ASSERT(read_vmem(0x1000, &val) == 0 && val == 0, "New space starts empty");
+    write_vmem(0x1000, 'B');
+    vm_space_switch(a);
+    read_vmem(0x1000, &val);
+    ASSERT(val == 'A', "Spaces do not see each other's pages");
+    
+    // Cached translations survive a round trip
+    uint32_t misses = stats.tlb_misses;
+    vm_space_switch(b);
+    read_vmem(0x1000, &val);
+    vm_space_switch(a);
+    read_vmem(0x1000, &val);
+    ASSERT(stats.tlb_misses == misses && stats.tlb_reuse_hits >= 2, "Switching does not flush the TLB");
+    ASSERT(stats.context_switches == 4, "Context switches counted");
+    vm_space_switch(a);
+    ASSERT(stats.context_switches == 4, "Switching to the current space is free");
+    
+    // Eviction reaches pages of other spaces
+    vm_space_switch(b);
+    for (uint32_t vp = 10; vp < 80; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    vm_space_switch(a);
+    read_vmem(0x1000, &val);
+    vm_space_switch(b);
+    bool ok = true;
+    for (uint32_t vp = 10; vp < 80; vp++) {
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != vp) ok = false;
+    }
+    ASSERT(ok && stats.swap_outs > 0, "Spaces share RAM and swap");
+    
+    ASSERT(vm_space_destroy(b) == -1, "Current space cannot be destroyed");
+    vm_space_switch(a);
+    uint32_t free_before = free_frames.count, slots_before = swap.free_slots.count;
+    ASSERT(vm_space_destroy(b) == 0 && free_frames.count > free_before &&
+           swap.free_slots.count > slots_before, "Destroy releases frames and slots");
+    read_vmem(0x1000, &val);
+    ASSERT(val == 'A', "Other spaces unaffected");
+    VMSpace *c = vm_space_create();
+    vm_space_switch(c);
+    ASSERT(read_vmem(0x1000, &val) == 0 && val == 0, "Recycled ASID sees no stale translations");
+    vm_space_switch(a);
+    
+    int n = 0;
+    while (vm_space_create()) n++;
+    ASSERT(n == VM_MAX_SPACES - 2, "One ASID per live space");
+    
+    free_pages();
+}
+
+void test_cow_clone(void) {
+    TEST_START("Copy-on-Write Clone");
+    VMConfig cfg = { .ram_size = 64 * PAGE_SIZE, .swap_slots = 64 };
+    init_vm_config(&cfg);
+    VMSpace *parent = vm_space_current();
+    for (uint32_t vp = 0; vp < 16; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    map_page(100, 60, PTE_READ);
+    
+    uint32_t free_before = free_frames.count;
+    VMSpace *child = vm_clone();
+    ASSERT(child && free_frames.count == free_before, "Clone copies no pages");
+    ASSERT(stats.clone_ptes == 17 && frames[pt_lookup(0)->phys_page].refs == 2, "Frames shared, one reference per PTE");
+    
+    // The first write copies only the page written
+    vm_space_switch(child);
+    uint8_t val;
+    ASSERT(read_vmem(5 * PAGE_SIZE, &val) == 0 && val == 5, "Child sees the parent's data");
+    ASSERT(write_vmem(5 * PAGE_SIZE, 55) == 0, "Write to a shared page succeeds");
+    ASSERT(stats.cow_copies == 1 && free_frames.count == free_before - 1, "Write copies one frame");
+    vm_space_switch(parent);
+    read_vmem(5 * PAGE_SIZE, &val);
+    ASSERT(val == 5, "Parent keeps its copy");
+    ASSERT(write_vmem(5 * PAGE_SIZE, 50) == 0, "Write to the last sharer succeeds");
+    ASSERT(stats.cow_copies == 1 && stats.cow_reuses == 1, "Last sharer writes in place");
+    ASSERT(write_vmem(100 * PAGE_SIZE, 1) != 0 && stats.cow_copies == 1, "Read-only pages stay read-only");
+    
+    // Unmapping one side leaves the other intact
+    unmap_page(6);
+    vm_space_switch(child);
+    read_vmem(6 * PAGE_SIZE, &val);
+    ASSERT(val == 6 && free_frames.count == free_before - 1, "Frame outlives one of its mappings");
+    ASSERT(write_vmem(6 * PAGE_SIZE, 66) == 0, "Remaining mapping is writable");
+    read_vmem(6 * PAGE_SIZE, &val);
+    ASSERT(val == 66 && stats.cow_copies == 1, "Remaining mapping takes the frame over");
+    
+    // Swapped pages share their slot until one side writes
+    VMConfig small = { .ram_size = 8 * PAGE_SIZE, .swap_slots = 64 };
+    init_vm_config(&small);
+    parent = vm_space_current();
+    for (uint32_t vp = 0; vp < 16; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    child = vm_clone();
+    uint32_t slots = swap.free_slots.count;
+    vm_space_switch(child);
+    bool ok = true;
+    for (uint32_t vp = 0; vp < 8; vp++) {
+        if (write_vmem(vp * PAGE_SIZE, 100 + vp) != 0) ok = false;
+    }
+    ASSERT(ok, "Writes to shared pages succeed while RAM is full");
+    vm_space_switch(parent);
+    for (uint32_t vp = 0; vp < 16; vp++) {
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != vp) ok = false;
+    }
+    vm_space_switch(child);
+    for (uint32_t vp = 0; vp < 16; vp++) {
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != (vp < 8 ? 100 + vp : vp)) ok = false;
+    }
+    ASSERT(ok && slots < 64, "Both sides keep their data through swap");
+    vm_space_switch(parent);
+    vm_space_destroy(child);
+    for (uint32_t vp = 0; vp < 16; vp++) unmap_page(vp);
+    ASSERT(swap.free_slots.count == 64 && free_frames.count == 8, "Everything released once both sides are gone");
+    
+    // Writing a shared page after it was evicted
+    init_vm_config(&small);
+    parent = vm_space_current();
+    for (uint32_t vp = 0; vp < 8; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    child = vm_clone();
+    vm_space_switch(child);
+    for (uint32_t vp = 100; vp < 116; vp++) write_vmem(vp * PAGE_SIZE, 1);
+    ASSERT(pt_lookup(0)->flags & PTE_SWAPPED, "Shared page evicted");
+    ASSERT(write_vmem(0, 77) == 0 && read_vmem(0, &val) == 0 && val == 77, "Write to an evicted shared page succeeds");
+    vm_space_switch(parent);
+    ASSERT(read_vmem(0, &val) == 0 && val == 0, "Other side keeps the old contents");
+    
+    free_pages();
+}
+
+void test_zero_page(void) {
+    TEST_START("Shared Zero Page");
+    VMConfig cfg = { .ram_size = 16 * PAGE_SIZE, .swap_slots = 16 };
+    init_vm_config(&cfg);
+    uint32_t free_before = free_frames.count + zero_pool.count;
+    
+    // Sparse reads cost no frames
+    bool ok = true;
+    for (uint32_t vp = 0; vp < 1000; vp += 10) {
+        uint8_t val = 0xFF;
+        if (read_vmem(vp * PAGE_SIZE + 7, &val) != 0 || val != 0) ok = false;
+    }
+    ASSERT(ok && stats.zero_page_maps == 100, "Reads of untouched pages return zero");
+    ASSERT(free_frames.count + zero_pool.count == free_before && stats.swap_outs == 0, "No frame allocated for reads");
+    ASSERT(pt_lookup(10)->phys_page == pt_lookup(20)->phys_page, "All readers share one frame");
+    
+    // The first write brings in a private zeroed frame
+    ASSERT(write_vmem(10 * PAGE_SIZE, 42) == 0, "Write after read succeeds");
+    uint8_t val;
+    read_vmem(10 * PAGE_SIZE, &val);
+    uint8_t other = 0xFF;
+    read_vmem(20 * PAGE_SIZE, &other);
+    ASSERT(val == 42 && other == 0 && stats.zero_page_upgrades == 1, "Only the written page gets a frame");
+    ASSERT(free_frames.count + zero_pool.count == free_before - 1, "One frame in use");
+    
+    // Unmapping and cloning leave the zero page alone
+    ASSERT(unmap_page(20) == 0 && free_frames.count + zero_pool.count == free_before - 1, "Unmapping frees nothing");
+    VMSpace *parent = vm_space_current();
+    read_vmem(30 * PAGE_SIZE, &val);
+    VMSpace *child = vm_clone();
+    vm_space_switch(child);
+    write_vmem(30 * PAGE_SIZE, 3);
+    vm_space_switch(parent);
+    read_vmem(30 * PAGE_SIZE, &val);
+    ASSERT(val == 0 && stats.zero_page_upgrades == 2, "Clone shares the zero page copy-on-write");
+    
+    free_pages();
+}
+
+void test_ksm(void) {
+    TEST_START("Same-Page Merging");
+    VMConfig cfg = { .ram_size = 64 * PAGE_SIZE, .ksm_interval = 1 };
+    init_vm_config(&cfg);
+    uint8_t page[PAGE_SIZE];
+    uint32_t free_before = free_frames.count + zero_pool.count;
+    
+    // 8 copies of one page, 8 written-then-cleared pages, 8 distinct pages
+    fill_page(page, 7, 512);
+    for (uint32_t vp = 0; vp < 8; vp++) write_vmem_range(vp * PAGE_SIZE, page, PAGE_SIZE, NULL);
+    for (uint32_t vp = 8; vp < 16; vp++) write_vmem(vp * PAGE_SIZE, 0);
+    for (uint32_t vp = 16; vp < 24; vp++) {
+        fill_page(page, vp, 512);
+        write_vmem_range(vp * PAGE_SIZE, page, PAGE_SIZE, NULL);
+    }
+    
+    // Steps are bounded by the batch size
+    uint8_t val;
+    uint64_t scanned = stats.ksm_scanned;
+    read_vmem(0, &val);
+    ASSERT(stats.ksm_scanned - scanned <= KSM_SCAN_BATCH, "One step hashes at most one batch");
+    
+    for (int i = 0; i < 64; i++) read_vmem(30 * PAGE_SIZE, &val);
+    ASSERT(stats.ksm_merges == 7 + 8 && stats.ksm_zero_merges == 8, "Duplicates and zero pages merged");
+    ASSERT(free_frames.count + zero_pool.count == free_before - 24 + 15, "Merged frames freed");
+    ASSERT(pt_lookup(3)->phys_page == pt_lookup(5)->phys_page &&
+           pt_lookup(16)->phys_page != pt_lookup(17)->phys_page, "Only identical pages share a frame");
+    
+    bool ok = true;
+    fill_page(page, 7, 512);
+    for (uint32_t vp = 0; vp < 8; vp++) {
+        if (read_vmem(vp * PAGE_SIZE + 100, &val) != 0 || val != page[100]) ok = false;
+    }
+    ASSERT(ok, "Merged pages read the same data");
+    
+    // A write breaks the sharing for that page only
+    ASSERT(write_vmem(2 * PAGE_SIZE + 100, (uint8_t)(page[100] + 1)) == 0, "Write to a merged page succeeds");
+    read_vmem(3 * PAGE_SIZE + 100, &val);
+    ASSERT(val == page[100] && stats.cow_copies == 1, "Writes copy the merged page");
+    ASSERT(write_vmem(9 * PAGE_SIZE, 5) == 0, "Write to a zero-merged page succeeds");
+    read_vmem(10 * PAGE_SIZE, &val);
+    ASSERT(val == 0 && stats.zero_page_upgrades == 1, "Zero-merged pages upgrade on write");
+    
+    // With RAM this small every step covers all frames, so a frame freed
+    // by a merge comes straight back for the write that breaks it
+    VMConfig tiny = { .ram_size = 16 * PAGE_SIZE, .ksm_interval = 1 };
+    init_vm_config(&tiny);
+    write_vmem(0, 0);
+    for (int i = 0; i < 4; i++) read_vmem(0, &val);
+    ASSERT(stats.ksm_zero_merges == 1, "Page merged into the zero page");
+    ASSERT(write_vmem(0, 0) == 0 && write_vmem(0, 5) == 0, "Writes after a zero merge succeed");
+    ASSERT(read_vmem(0, &val) == 0 && val == 5, "Written value reads back");
+    write_vmem(PAGE_SIZE, 9);
+    write_vmem(2 * PAGE_SIZE, 9);
+    for (int i = 0; i < 4; i++) read_vmem(0, &val);
+    ASSERT(stats.ksm_merges == 2, "Duplicate pages merged");
+    ASSERT(write_vmem(PAGE_SIZE, 9) == 0 && write_vmem(2 * PAGE_SIZE + 1, 3) == 0, "Writes after a merge succeed");
+    
+    // Merged pages evicted to swap and written afterwards
+    VMConfig small = { .ram_size = 8 * PAGE_SIZE, .swap_slots = 64, .ksm_interval = 1 };
+    init_vm_config(&small);
+    for (uint32_t vp = 0; vp < 4; vp++) write_vmem(vp * PAGE_SIZE, 9);
+    for (int i = 0; i < 4; i++) read_vmem(0, &val);
+    uint32_t merged = stats.ksm_merges;
+    for (uint32_t vp = 100; vp < 116; vp++) write_vmem(vp * PAGE_SIZE, (uint8_t)vp);
+    ok = merged == 3 && (pt_lookup(1)->flags & PTE_SWAPPED);
+    for (uint32_t vp = 0; vp < 4; vp++) {
+        if (write_vmem(vp * PAGE_SIZE + 1, (uint8_t)vp) != 0) ok = false;
+    }
+    for (uint32_t vp = 0; vp < 4; vp++) {
+        if (read_vmem(vp * PAGE_SIZE, &val) != 0 || val != 9 ||
+            read_vmem(vp * PAGE_SIZE + 1, &val) != 0 || val != vp) ok = false;
+    }
+    ASSERT(ok, "Writes to evicted merged pages succeed");
+    
+    init_vm();
+    for (int i = 0; i < 100; i++) read_vmem(0, &val);
+    ASSERT(stats.ksm_scanned == 0, "Scanner is off by default");
+    
+    free_pages();
+}
+
+void test_rmap(void) {
+    TEST_START("Reverse Map");
+    VMConfig cfg = { .ram_size = 16 * PAGE_SIZE, .swap_slots = 64 };
+    init_vm_config(&cfg);
+    
+    // Remapping a page releases its old frame; frames owned elsewhere are refused
+    map_page(30, 5, PTE_READ | PTE_WRITE);
+    map_page(30, 6, PTE_READ | PTE_WRITE);
+    ASSERT(bitmap_test(&free_frames, 5) && frames[6].pte == pt_lookup(30), "Remap frees the replaced frame");
+    int raw = alloc_phys_pages(0);
+    ASSERT(map_page(31, raw, PTE_READ) != 0 && !(pt_lookup(31) && pt_lookup(31)->flags), "Allocated but unmapped frame refused");
+    free_phys_page(raw);
+    unmap_page(30);
+    
+    // One frame mapped twice by hand
+    map_page(10, 3, PTE_READ | PTE_WRITE);
+    map_page(20, 3, PTE_READ | PTE_WRITE);
+    ASSERT(frames[3].refs == 2 && frames[3].rmap >= 0, "Second mapping joins the reverse map");
+    uint8_t val;
+    write_vmem(10 * PAGE_SIZE, 42);
+    ASSERT(read_vmem(20 * PAGE_SIZE, &val) == 0 && val == 42, "Both mappings see one frame");
+    for (uint32_t vp = 100; vp < 140; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    ASSERT(stats.swap_outs > 0 && pt_lookup(20)->phys_page == 3, "Aliased frame stays resident");
+    write_vmem(20 * PAGE_SIZE, 43);
+    unmap_page(10);
+    ASSERT(!bitmap_test(&free_frames, 3) && frames[3].refs == 1 && frames[3].pins == 0, "Unmapping one alias keeps the frame");
+    ASSERT(frames[3].pte == pt_lookup(20) && (frames[3].pte->flags & PTE_DIRTY), "Remaining mapping is tracked");
+    ASSERT(read_vmem(20 * PAGE_SIZE, &val) == 0 && val == 43, "Remaining mapping keeps the data");
+    unmap_page(20);
+    ASSERT(bitmap_test(&free_frames, 3), "Last unmap frees the frame");
+    
+    // Clones chain their PTEs off the frame
+    init_vm_config(&cfg);
+    VMSpace *parent = vm_space_current();
+    for (uint32_t vp = 0; vp < 4; vp++) write_vmem(vp * PAGE_SIZE, vp + 1);
+    VMSpace *kids[3];
+    for (int k = 0; k < 3; k++) kids[k] = vm_clone();
+    int f = pt_lookup(0)->phys_page;
+    int chain = 0;
+    for (int32_t r = frames[f].rmap; r >= 0; r = rmap.entries[r].next) chain++;
+    ASSERT(frames[f].refs == 4 && chain == 3, "One chained entry per extra mapping");
+    vm_space_destroy(kids[1]);
+    ASSERT(frames[f].refs == 3 && frames[f].space == parent, "Destroying a clone unlinks its PTE");
+    unmap_page(0);
+    ASSERT(frames[f].refs == 2 && frames[f].space != parent, "A clone's PTE takes over from the parent");
+    vm_space_switch(kids[2]);
+    ASSERT(read_vmem(0, &val) == 0 && val == 1, "Clone still reads the shared page");
+    for (uint32_t vp = 100; vp < 140; vp++) write_vmem(vp * PAGE_SIZE, vp);
+    vm_space_switch(kids[0]);
+    ASSERT(read_vmem(0, &val) == 0 && val == 1, "Shared page survives eviction");
+    vm_space_switch(parent);
+    vm_space_destroy(kids[0]);
+    vm_space_destroy(kids[2]);
+    
+    // Aliases stay one memory across a clone
+    init_vm_config(&cfg);
+    parent = vm_space_current();
+    map_page(10, 3, PTE_READ | PTE_WRITE);
+    map_page(20, 3, PTE_READ | PTE_WRITE);
+    write_vmem(10 * PAGE_SIZE, 0x11);
+    VMSpace *kid = vm_clone();
+    bool ok = write_vmem(10 * PAGE_SIZE, 0x22) == 0 && read_vmem(20 * PAGE_SIZE, &val) == 0 && val == 0x22;
+    vm_space_switch(kid);
+    ok = ok && read_vmem(20 * PAGE_SIZE, &val) == 0 && val == 0x22;
+    ok = ok && write_vmem(10 * PAGE_SIZE, 0x33) == 0;
+    vm_space_switch(parent);
+    ok = ok && read_vmem(20 * PAGE_SIZE, &val) == 0 && val == 0x33;
+    ASSERT(ok && stats.cow_copies == 0 && frames[3].refs == 4, "Aliases stay coherent across a clone");
+    vm_space_destroy(kid);
+    
+    free_pages();
+}
+
 void run_all_tests(void) {
     printf("\n");
     printf("╔════════════════════════════════════════╗\n");
@@ -255,6 +1424,31 @@ void run_all_tests(void) {
     test_large_data_transfer();
     test_physical_memory_exhaustion();
     test_two_level_table_structure();
+    test_tlb();
+    test_range_access();
+    test_typed_access();
+    test_event_ring();
+    test_frame_bitmap();
+    test_buddy_allocator();
+    test_zero_pool();
+    test_radix_table();
+    test_superpages();
+    test_swap();
+    test_clock_replacement();
+    test_policies();
+    test_dirty_tracking();
+    test_zswap();
+    test_async_swap();
+    test_readahead();
+    test_fault_around();
+    test_working_set();
+    test_mglru();
+    test_swap_clusters();
+    test_address_spaces();
+    test_cow_clone();
+    test_zero_page();
+    test_ksm();
+    test_rmap();
     
     printf("\n");
     printf("╔════════════════════════════════════════╗\n");